@@ -8,6 +8,10 @@
 #define DS18B20_GROUP_MAX_SIZE CONFIG_DS18B20_GROUP_MAX_SIZE
 #endif
 
+#ifndef DS18B20_GROUP_MAX_BUSES
+#define DS18B20_GROUP_MAX_BUSES CONFIG_DS18B20_GROUP_MAX_BUSES
+#endif
+
 #ifndef DS18B20_FAMILY
 #define DS18B20_FAMILY 0x28
 #endif
@@ -18,9 +22,40 @@ extern "C" {
 
 struct ds18b20_group_handle
 {
-    OneWireBus *owb;
+    OneWireBus *buses[DS18B20_GROUP_MAX_BUSES];
+    uint8_t bus_count;
     DS18B20_Info devices[DS18B20_GROUP_MAX_SIZE];
     uint8_t count;
+    int64_t conversion_start; // esp_timer_get_time() of pending conversion, 0 if none
+    uint16_t read_periods[DS18B20_GROUP_MAX_SIZE];   // In conversion cycles, see ds18b20_group_set_read_period()
+    uint16_t read_countdowns[DS18B20_GROUP_MAX_SIZE]; // Cycles until next read, 0 means read on next ds18b20_group_read_all()
+    uint8_t device_buses[DS18B20_GROUP_MAX_SIZE];     // Bus index of each device
+    bool present[DS18B20_GROUP_MAX_SIZE];             // Absent devices are skipped by ds18b20_group_read_all(), see ds18b20_group_rescan_step()
+    bool use_crc;                                     // Applied to devices added later
+    DS18B20_RESOLUTION resolution;                    // Applied to devices added later, 0 keeps their own
+
+    // Incremental search state, see ds18b20_group_rescan_step()
+    struct
+    {
+        bool active;
+        bool first; // Next step starts search of the bus
+        uint8_t bus;
+        OneWireBus_SearchState state;
+        bool seen[DS18B20_GROUP_MAX_SIZE];
+    } rescan;
+};
+
+/**
+     * Result of a single sensor readout, see ds18b20_group_read_all().
+     */
+struct ds18b20_group_result
+{
+    esp_err_t status;
+    int16_t raw;          // Raw value in 1/16 °C
+    float value_c;        // Value in °C, valid only if status is ESP_OK
+    uint32_t duration_us; // Time spent on the bus, including retries
+    bool fresh;           // Read in last ds18b20_group_read_all(), false if it was not due
+    int64_t timestamp;    // esp_timer_get_time() of last successful read, 0 if never
 };
 
 /**
@@ -32,6 +67,7 @@ typedef struct ds18b20_group_handle *ds18b20_group_handle_t;
      * @brief Creates and initializes group of DS18B20 sensors on one bus.
      *
      * Creates new instance of ds18b20_group_handle. This have to be freed using ds18b20_group_delete().
+     * More buses can be added via ds18b20_group_add_bus().
      *
      * To populate the list, ds18b20_group_find() needs to be called before any other methods.
      *
@@ -41,6 +77,20 @@ typedef struct ds18b20_group_handle *ds18b20_group_handle_t;
      */
 esp_err_t ds18b20_group_create(OneWireBus *owb, ds18b20_group_handle_t *handle);
 
+/**
+     * @brief Adds another bus to the group.
+     *
+     * Conversions are started on all buses at once, so they run in parallel. Devices are indexed flat,
+     * in order of buses, so index based methods work regardless of bus count.
+     *
+     * Must be called before ds18b20_group_find().
+     *
+     * @param handle Group handle
+     * @param owb Reference to initialized OneWireBus, must use different RMT channels than other buses
+     * @return ESP_OK if operation succeded, ESP_ERR_NO_MEM if DS18B20_GROUP_MAX_BUSES is reached.
+     */
+esp_err_t ds18b20_group_add_bus(ds18b20_group_handle_t handle, OneWireBus *owb);
+
 /**
      * Delete handle and release its memory.
      *
@@ -48,18 +98,153 @@ esp_err_t ds18b20_group_create(OneWireBus *owb, ds18b20_group_handle_t *handle);
      */
 void ds18b20_group_delete(ds18b20_group_handle_t handle);
 
+/**
+     * @brief Searches all buses and replaces devices of the group with found ones.
+     *
+     * Devices of other families are skipped.
+     *
+     * @param handle Group handle
+     * @return ESP_OK on success.
+     */
 esp_err_t ds18b20_group_find(ds18b20_group_handle_t handle);
 
+/**
+     * @brief Adds device with known ROM code, without searching the bus.
+     *
+     * Allows boot to skip the search, when devices are known from previous run. Device is assumed to be present,
+     * until ds18b20_group_rescan_step() finds otherwise.
+     *
+     * @param handle Group handle
+     * @param bus Bus index, in order the buses were added
+     * @param rom_code ROM code of the device
+     * @return ESP_OK on success, ESP_ERR_NO_MEM if group is full, ESP_ERR_INVALID_STATE if device is already in the group,
+     *         ESP_ERR_INVALID_ARG on unknown bus or unsupported family.
+     */
+esp_err_t ds18b20_group_add_device(ds18b20_group_handle_t handle, uint8_t bus, const OneWireBus_ROMCode *rom_code);
+
+/**
+     * @brief Performs one step of incremental search, which finds at most one device.
+     *
+     * Meant to be called once per cycle, between conversions, so the search never stalls the caller for long.
+     * Must not be called while conversion is in progress.
+     *
+     * New devices are appended to the group, so indexes of existing devices never change. Once all buses were searched,
+     * devices that did not respond are marked absent, and are not read until they show up again.
+     *
+     * @param handle Group handle
+     * @param changed Set to true when a device was added, or its presence changed
+     * @param done Set to true when the step finished the pass over all buses, next call starts a new one
+     * @return ESP_OK on success, ESP_FAIL on bus error, the pass is abandoned then, without changing presence.
+     */
+esp_err_t ds18b20_group_rescan_step(ds18b20_group_handle_t handle, bool *changed, bool *done);
+
 esp_err_t ds18b20_group_use_crc(ds18b20_group_handle_t handle, bool crc);
 
 esp_err_t ds18b20_group_set_resolution(ds18b20_group_handle_t handle, DS18B20_RESOLUTION resolution);
 
+/**
+     * @brief Sets resolution of a single device. Does nothing if resolution is already set.
+     *
+     * Must not be called while conversion is in progress.
+     *
+     * @param handle Group handle
+     * @param index Device index
+     * @param resolution New resolution
+     * @return ESP_OK on success, ESP_FAIL if device did not accept it.
+     */
+esp_err_t ds18b20_group_set_resolution_single(ds18b20_group_handle_t handle, uint8_t index, DS18B20_RESOLUTION resolution);
+
+/**
+     * @brief Returns current resolution of a device.
+     *
+     * @param handle Group handle
+     * @param index Device index
+     * @return Resolution, DS18B20_RESOLUTION_INVALID on invalid arguments.
+     */
+DS18B20_RESOLUTION ds18b20_group_get_resolution(ds18b20_group_handle_t handle, uint8_t index);
+
+/**
+     * @brief Adaptive resolution, chooses resolution of a device by how its temperature behaves.
+     *
+     * Uses 12-bit when the value is within DS18B20_GROUP_ADAPTIVE_BAND_MC of a control threshold,
+     * 11-bit within twice that band, 9-bit when it changes faster than DS18B20_GROUP_ADAPTIVE_FAST_RATE_MC
+     * per second, and 10-bit otherwise. Conversion time of the group follows the highest resolution in use.
+     *
+     * Must not be called while conversion is in progress.
+     *
+     * @param handle Group handle
+     * @param index Device index
+     * @param rate_c_per_s Rate of change of the temperature
+     * @param distance_c Distance to nearest threshold where precision matters, INFINITY if there is none
+     * @return ESP_OK on success, ESP_FAIL if device did not accept it.
+     */
+esp_err_t ds18b20_group_adapt_resolution(ds18b20_group_handle_t handle, uint8_t index, float rate_c_per_s, float distance_c);
+
 esp_err_t ds18b20_group_convert(ds18b20_group_handle_t handle);
 
 esp_err_t ds18b20_group_wait_for_conversion(ds18b20_group_handle_t handle);
 
+/**
+     * @brief Returns maximum conversion time of the group, based on the highest resolution of its devices.
+     *
+     * @param handle Group handle
+     * @return Conversion time in ms, 0 on invalid handle.
+     */
+uint32_t ds18b20_group_conversion_time_ms(ds18b20_group_handle_t handle);
+
+/**
+     * @brief Non-blocking check whether conversion started by ds18b20_group_convert() has finished.
+     *
+     * Allows pipelined acquisition - start conversion, do other work, and read results on the next
+     * tick once this reports ready. Completion is derived from elapsed time, so it works for parasitic-powered
+     * devices too, and does not occupy the bus.
+     *
+     * @param handle Group handle
+     * @param ready Set to true when conversion time has elapsed
+     * @return ESP_OK on success, ESP_ERR_INVALID_STATE when no conversion is pending.
+     */
+esp_err_t ds18b20_group_conversion_ready(ds18b20_group_handle_t handle, bool *ready);
+
 esp_err_t ds18b20_group_read_single(ds18b20_group_handle_t handle, uint8_t index, float *value_c);
 
+/**
+     * @brief Reads all devices in the group in one pass.
+     *
+     * Uses shortest transaction the CRC mode allows - without CRC, only two temperature bytes are read.
+     * Read failing on CRC is retried immediately, up to DS18B20_GROUP_READ_RETRIES times.
+     *
+     * Only devices due per their read period are read, see ds18b20_group_set_read_period().
+     * Results of other devices are left intact, except fresh flag, so their age can be derived from timestamp.
+     *
+     * @param handle Group handle
+     * @param results Array of results, indexed same as devices
+     * @param results_len Length of results array, must be at least handle->count
+     * @return ESP_OK if all reads succeeded, ESP_FAIL if any of them failed, see individual status.
+     */
+esp_err_t ds18b20_group_read_all(ds18b20_group_handle_t handle, struct ds18b20_group_result *results, size_t results_len);
+
+/**
+     * @brief Sets how often is device read by ds18b20_group_read_all().
+     *
+     * Slowly changing devices can be read less often, which cuts bus transactions per cycle.
+     * All devices are read every cycle by default.
+     *
+     * @param handle Group handle
+     * @param index Device index
+     * @param period Read every n-th cycle, 0 and 1 both mean every cycle
+     * @return ESP_OK on success.
+     */
+esp_err_t ds18b20_group_set_read_period(ds18b20_group_handle_t handle, uint8_t index, uint16_t period);
+
+/**
+     * @brief Requests device to be read on next ds18b20_group_read_all(), regardless of its period.
+     *
+     * @param handle Group handle
+     * @param index Device index
+     * @return ESP_OK on success.
+     */
+esp_err_t ds18b20_group_request_read(ds18b20_group_handle_t handle, uint8_t index);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,37 +1,63 @@
 #include "ds18b20_group.h"
 #include <ds18b20.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <owb.h>
 #include <owb_rmt.h>
 #include <string.h>
 
 static const char TAG[] = "ds18b20_group";
 
-inline static bool ds18b20_check_family(const OneWireBus_ROMCode *rom_code)
-{
-    return rom_code->bytes[0] == DS18B20_FAMILY;
-}
+#define DS18B20_FUNCTION_SCRATCHPAD_READ 0xBE
+#define DS18B20_SCRATCHPAD_SIZE 9
+#define DS18B20_GROUP_READ_RETRIES CONFIG_DS18B20_GROUP_READ_RETRIES
+#define DS18B20_GROUP_ADAPTIVE_BAND_C (CONFIG_DS18B20_GROUP_ADAPTIVE_BAND_MC / 1000.0f)
+#define DS18B20_GROUP_ADAPTIVE_FAST_RATE_C (CONFIG_DS18B20_GROUP_ADAPTIVE_FAST_RATE_MC / 1000.0f)
 
-esp_err_t ds18b20_group_create(OneWireBus *owb, ds18b20_group_handle_t *handle)
+inline static uint32_t ds18b20_resolution_conversion_time_ms(DS18B20_RESOLUTION resolution)
 {
-    if (owb == NULL || handle == NULL)
+    // Max conversion times as per datasheet
+    switch (resolution)
     {
-        return ESP_ERR_INVALID_ARG;
+    case DS18B20_RESOLUTION_9_BIT:
+        return 94;
+    case DS18B20_RESOLUTION_10_BIT:
+        return 188;
+    case DS18B20_RESOLUTION_11_BIT:
+        return 375;
+    default:
+        return 750;
     }
+}
 
-    ds18b20_group_handle_t result = (ds18b20_group_handle_t)malloc(sizeof(*result));
-    if (result == NULL)
+inline static int16_t ds18b20_resolution_mask(DS18B20_RESOLUTION resolution)
+{
+    // Lower bits are undefined in lower resolutions
+    switch (resolution)
     {
-        return ESP_ERR_NO_MEM;
+    case DS18B20_RESOLUTION_9_BIT:
+        return ~0x7;
+    case DS18B20_RESOLUTION_10_BIT:
+        return ~0x3;
+    case DS18B20_RESOLUTION_11_BIT:
+        return ~0x1;
+    default:
+        return ~0x0;
     }
+}
 
-    // Init
-    memset(result, 0, sizeof(*result));
-    result->owb = owb;
+inline static bool ds18b20_check_family(const OneWireBus_ROMCode *rom_code)
+{
+    return rom_code->bytes[0] == DS18B20_FAMILY;
+}
 
+static void ds18b20_group_init_bus(OneWireBus *owb)
+{
     // Check for parasitic-powered devices
     bool parasitic_power = false;
-    DS18B20_ERROR err = ds18b20_check_for_parasite_power(result->owb, &parasitic_power);
+    DS18B20_ERROR err = ds18b20_check_for_parasite_power(owb, &parasitic_power);
     if (err != DS18B20_OK)
     {
         ESP_LOGW(TAG, "failed to check for parasitic power: %d", err);
@@ -44,13 +70,49 @@ esp_err_t ds18b20_group_create(OneWireBus *owb, ds18b20_group_handle_t *handle)
 
     // In parasitic-power mode, devices cannot indicate when conversions are complete,
     // so waiting for a temperature conversion must be done by waiting a prescribed duration
-    owb_use_parasitic_power(result->owb, parasitic_power);
+    owb_use_parasitic_power(owb, parasitic_power);
+}
+
+esp_err_t ds18b20_group_create(OneWireBus *owb, ds18b20_group_handle_t *handle)
+{
+    if (owb == NULL || handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ds18b20_group_handle_t result = (ds18b20_group_handle_t)malloc(sizeof(*result));
+    if (result == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Init
+    memset(result, 0, sizeof(*result));
+    result->buses[0] = owb;
+    result->bus_count = 1;
+    ds18b20_group_init_bus(owb);
 
     // Success
     *handle = result;
     return ESP_OK;
 }
 
+esp_err_t ds18b20_group_add_bus(ds18b20_group_handle_t handle, OneWireBus *owb)
+{
+    if (handle == NULL || owb == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->bus_count >= DS18B20_GROUP_MAX_BUSES)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    handle->buses[handle->bus_count++] = owb;
+    ds18b20_group_init_bus(owb);
+    return ESP_OK;
+}
+
 void ds18b20_group_delete(ds18b20_group_handle_t handle)
 {
     if (handle != NULL)
@@ -59,16 +121,28 @@ void ds18b20_group_delete(ds18b20_group_handle_t handle)
     }
 }
 
-esp_err_t ds18b20_group_find(ds18b20_group_handle_t handle)
+static void ds18b20_group_init_device(ds18b20_group_handle_t handle, uint8_t index, uint8_t bus, const OneWireBus_ROMCode *rom_code, bool solo)
 {
-    if (handle == NULL)
+    DS18B20_Info *device = &handle->devices[index];
+    if (solo)
     {
-        return ESP_ERR_INVALID_ARG;
+        // ROM code is kept, so the device can be identified, and addressed once other device shows up
+        ds18b20_init_solo(device, handle->buses[bus]);
+        device->rom_code = *rom_code;
     }
+    else
+    {
+        ds18b20_init(device, handle->buses[bus], *rom_code);
+    }
+    handle->device_buses[index] = bus;
+    handle->present[index] = true;
+    handle->read_periods[index] = 0;
+    handle->read_countdowns[index] = 0;
+}
 
-    // Reset
-    handle->count = 0;
-    memset(handle->devices, 0, sizeof(handle->devices));
+static uint8_t ds18b20_group_find_bus(ds18b20_group_handle_t handle, uint8_t bus)
+{
+    OneWireBus *owb = handle->buses[bus];
 
     // Search
     OneWireBus_SearchState search_state = {0};
@@ -77,8 +151,9 @@ esp_err_t ds18b20_group_find(ds18b20_group_handle_t handle)
     OneWireBus_ROMCode owb_devices[DS18B20_GROUP_MAX_SIZE] = {};
     uint8_t total_count = 0;  // Total count of all devices
     uint8_t device_count = 0; // Supported ds18b20 devices
+    uint8_t free_count = DS18B20_GROUP_MAX_SIZE - handle->count;
 
-    owb_search_first(handle->owb, &search_state, &found);
+    owb_search_first(owb, &search_state, &found);
     while (found)
     {
         // Increment total count
@@ -88,51 +163,227 @@ esp_err_t ds18b20_group_find(ds18b20_group_handle_t handle)
         char rom_code_s[17] = {};
         owb_string_from_rom_code(search_state.rom_code, rom_code_s, sizeof(rom_code_s));
 
-        // Ignore if not correct family
         if (!ds18b20_check_family(&search_state.rom_code))
         {
+            // Skip it, devices after it can still be supported
             ESP_LOGI(TAG, "found unsupported device: %s", rom_code_s);
-            break;
         }
+        else if (device_count >= free_count)
+        {
+            ESP_LOGW(TAG, "found too many ds18b20 devices, ignoring %s", rom_code_s);
+        }
+        else
+        {
+            // Log
+            ESP_LOGI(TAG, "found device %u: %s", handle->count + device_count, rom_code_s);
 
-        // Log
-        ESP_LOGI(TAG, "found device %u: %s", device_count, rom_code_s);
-
-        // Store and increment count
-        owb_devices[device_count++] = search_state.rom_code;
+            // Store and increment count
+            owb_devices[device_count++] = search_state.rom_code;
+        }
 
         // Search next
         found = false;
-        owb_search_next(handle->owb, &search_state, &found);
+        owb_search_next(owb, &search_state, &found);
+    }
 
-        // Buffer overflow
-        if (found && device_count >= DS18B20_GROUP_MAX_SIZE)
+    // Special handling - if sensor is one and only device on the bus, we can skip addressing
+    bool solo = device_count == 1 && total_count == 1;
+    for (size_t i = 0; i < device_count; i++)
+    {
+        ds18b20_group_init_device(handle, handle->count + i, bus, &owb_devices[i], solo);
+    }
+
+    return device_count;
+}
+
+esp_err_t ds18b20_group_find(ds18b20_group_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Reset
+    handle->count = 0;
+    memset(handle->devices, 0, sizeof(handle->devices));
+    memset(handle->read_periods, 0, sizeof(handle->read_periods));
+    memset(handle->read_countdowns, 0, sizeof(handle->read_countdowns));
+    memset(handle->present, 0, sizeof(handle->present));
+    memset(&handle->rescan, 0, sizeof(handle->rescan));
+
+    // Devices are indexed flat, in order of buses
+    for (uint8_t b = 0; b < handle->bus_count && handle->count < DS18B20_GROUP_MAX_SIZE; b++)
+    {
+        handle->count += ds18b20_group_find_bus(handle, b);
+    }
+
+    ESP_LOGI(TAG, "found %u ds18b20 devices on %u buses", handle->count, handle->bus_count);
+    return ESP_OK;
+}
+
+static int ds18b20_group_index_of(ds18b20_group_handle_t handle, const OneWireBus_ROMCode *rom_code)
+{
+    for (int i = 0; i < handle->count; i++)
+    {
+        if (memcmp(handle->devices[i].rom_code.bytes, rom_code->bytes, sizeof(rom_code->bytes)) == 0)
         {
-            ESP_LOGW(TAG, "found too many ds18b20 devices");
-            break;
+            return i;
         }
     }
+    return -1;
+}
 
-    // Special handling - if sensor is one and only device on the bus, we can skip addressing
-    if (device_count == 1 && total_count == 1)
+static void ds18b20_group_unsolo(ds18b20_group_handle_t handle, uint8_t bus)
+{
+    // Solo device would answer commands meant for other devices on its bus
+    for (size_t i = 0; i < handle->count; i++)
     {
-        // Initialize and set count to 1
-        ds18b20_init_solo(&handle->devices[0], handle->owb);
-        handle->count = 1;
+        if (handle->device_buses[i] == bus)
+        {
+            handle->devices[i].solo = false;
+        }
     }
-    else
+}
+
+esp_err_t ds18b20_group_add_device(ds18b20_group_handle_t handle, uint8_t bus, const OneWireBus_ROMCode *rom_code)
+{
+    if (handle == NULL || rom_code == NULL || bus >= handle->bus_count || !ds18b20_check_family(rom_code))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ds18b20_group_index_of(handle, rom_code) >= 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (handle->count >= DS18B20_GROUP_MAX_SIZE)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ds18b20_group_unsolo(handle, bus);
+
+    uint8_t index = handle->count++;
+    ds18b20_group_init_device(handle, index, bus, rom_code, false);
+    ds18b20_use_crc(&handle->devices[index], handle->use_crc);
+    if (handle->resolution != 0)
     {
-        // Initialize
-        for (size_t i = 0; i < device_count; i++)
+        ds18b20_group_set_resolution_single(handle, index, handle->resolution);
+    }
+
+    char rom_code_s[17] = {};
+    owb_string_from_rom_code(*rom_code, rom_code_s, sizeof(rom_code_s));
+    ESP_LOGI(TAG, "added device %u: %s", index, rom_code_s);
+    return ESP_OK;
+}
+
+static void ds18b20_group_restore_resolution(ds18b20_group_handle_t handle, uint8_t index, DS18B20_RESOLUTION resolution)
+{
+    // Power-cycled device is back at its EEPROM resolution, so resolution the group assumes is written again,
+    // otherwise conversion timing and read mask would not match the device
+    if (resolution == DS18B20_RESOLUTION_INVALID)
+    {
+        resolution = handle->resolution;
+    }
+    if (resolution != DS18B20_RESOLUTION_INVALID && resolution != 0 && !ds18b20_set_resolution(&handle->devices[index], resolution))
+    {
+        ESP_LOGW(TAG, "failed to restore resolution of sensor %u to %d bits", index, resolution);
+    }
+}
+
+esp_err_t ds18b20_group_rescan_step(ds18b20_group_handle_t handle, bool *changed, bool *done)
+{
+    if (handle == NULL || changed == NULL || done == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *changed = false;
+    *done = false;
+    if (handle->bus_count == 0)
+    {
+        *done = true;
+        return ESP_OK;
+    }
+
+    if (!handle->rescan.active)
+    {
+        memset(&handle->rescan, 0, sizeof(handle->rescan));
+        handle->rescan.active = true;
+        handle->rescan.first = true;
+    }
+
+    // Single search step, finds next device on the bus
+    OneWireBus *owb = handle->buses[handle->rescan.bus];
+    bool found = false;
+    owb_status status = handle->rescan.first ? owb_search_first(owb, &handle->rescan.state, &found)
+                                             : owb_search_next(owb, &handle->rescan.state, &found);
+    handle->rescan.first = false;
+    if (status != OWB_STATUS_OK)
+    {
+        // Partial pass would retire devices it did not get to
+        ESP_LOGW(TAG, "rescan of bus %u failed: %d", handle->rescan.bus, status);
+        handle->rescan.active = false;
+        return ESP_FAIL;
+    }
+
+    if (found)
+    {
+        const OneWireBus_ROMCode *rom_code = &handle->rescan.state.rom_code;
+        int index = ds18b20_group_index_of(handle, rom_code);
+        if (!ds18b20_check_family(rom_code))
         {
-            ds18b20_init(&handle->devices[i], handle->owb, owb_devices[i]);
+            ds18b20_group_unsolo(handle, handle->rescan.bus);
         }
+        else if (index >= 0)
+        {
+            handle->rescan.seen[index] = true;
+            if (handle->device_buses[index] != handle->rescan.bus)
+            {
+                ESP_LOGI(TAG, "device %d moved to bus %u", index, handle->rescan.bus);
+                DS18B20_RESOLUTION resolution = handle->devices[index].resolution;
+                ds18b20_group_unsolo(handle, handle->rescan.bus);
+                ds18b20_group_init_device(handle, index, handle->rescan.bus, rom_code, false);
+                ds18b20_use_crc(&handle->devices[index], handle->use_crc);
+                ds18b20_group_restore_resolution(handle, index, resolution);
+                *changed = true;
+            }
+            else if (!handle->present[index])
+            {
+                ESP_LOGI(TAG, "device %d is back", index);
+                handle->present[index] = true;
+                handle->read_countdowns[index] = 0;
+                ds18b20_group_restore_resolution(handle, index, handle->devices[index].resolution);
+                *changed = true;
+            }
+        }
+        else if (ds18b20_group_add_device(handle, handle->rescan.bus, rom_code) == ESP_OK)
+        {
+            handle->rescan.seen[handle->count - 1] = true;
+            *changed = true;
+        }
+        return ESP_OK;
+    }
 
-        // Store count
-        handle->count = device_count;
+    // Bus is done, continue with next one
+    handle->rescan.bus++;
+    handle->rescan.first = true;
+    if (handle->rescan.bus < handle->bus_count)
+    {
+        return ESP_OK;
     }
 
-    ESP_LOGI(TAG, "found %u ds18b20 devices", handle->count);
+    // Pass is done, whatever did not respond is gone
+    for (uint8_t i = 0; i < handle->count; i++)
+    {
+        if (handle->present[i] && !handle->rescan.seen[i])
+        {
+            ESP_LOGW(TAG, "device %u is gone", i);
+            handle->present[i] = false;
+            *changed = true;
+        }
+    }
+    handle->rescan.active = false;
+    *done = true;
     return ESP_OK;
 }
 
@@ -143,6 +394,7 @@ esp_err_t ds18b20_group_use_crc(ds18b20_group_handle_t handle, bool crc)
         return ESP_ERR_INVALID_ARG;
     }
 
+    handle->use_crc = crc;
     for (size_t i = 0; i < handle->count; i++)
     {
         ds18b20_use_crc(&handle->devices[i], crc);
@@ -158,6 +410,7 @@ esp_err_t ds18b20_group_set_resolution(ds18b20_group_handle_t handle, DS18B20_RE
         return ESP_ERR_INVALID_ARG;
     }
 
+    handle->resolution = resolution;
     for (size_t i = 0; i < handle->count; i++)
     {
         ds18b20_set_resolution(&handle->devices[i], resolution);
@@ -166,6 +419,66 @@ esp_err_t ds18b20_group_set_resolution(ds18b20_group_handle_t handle, DS18B20_RE
     return ESP_OK;
 }
 
+esp_err_t ds18b20_group_set_resolution_single(ds18b20_group_handle_t handle, uint8_t index, DS18B20_RESOLUTION resolution)
+{
+    if (handle == NULL || index >= handle->count)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Avoid bus transaction, if there is no change
+    if (handle->devices[index].resolution == resolution)
+    {
+        return ESP_OK;
+    }
+    if (!ds18b20_set_resolution(&handle->devices[index], resolution))
+    {
+        ESP_LOGW(TAG, "failed to set resolution of sensor %u to %d bits", index, resolution);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGD(TAG, "sensor %u resolution changed to %d bits", index, resolution);
+    return ESP_OK;
+}
+
+DS18B20_RESOLUTION ds18b20_group_get_resolution(ds18b20_group_handle_t handle, uint8_t index)
+{
+    if (handle == NULL || index >= handle->count)
+    {
+        return DS18B20_RESOLUTION_INVALID;
+    }
+    return handle->devices[index].resolution;
+}
+
+esp_err_t ds18b20_group_adapt_resolution(ds18b20_group_handle_t handle, uint8_t index, float rate_c_per_s, float distance_c)
+{
+    if (handle == NULL || index >= handle->count)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Precision matters near the threshold, speed when temperature moves fast, and little of both otherwise
+    DS18B20_RESOLUTION resolution;
+    if (distance_c < DS18B20_GROUP_ADAPTIVE_BAND_C)
+    {
+        resolution = DS18B20_RESOLUTION_12_BIT;
+    }
+    else if (distance_c < 2 * DS18B20_GROUP_ADAPTIVE_BAND_C)
+    {
+        resolution = DS18B20_RESOLUTION_11_BIT;
+    }
+    else if (rate_c_per_s >= DS18B20_GROUP_ADAPTIVE_FAST_RATE_C || rate_c_per_s <= -DS18B20_GROUP_ADAPTIVE_FAST_RATE_C)
+    {
+        resolution = DS18B20_RESOLUTION_9_BIT;
+    }
+    else
+    {
+        resolution = DS18B20_RESOLUTION_10_BIT;
+    }
+
+    return ds18b20_group_set_resolution_single(handle, index, resolution);
+}
+
 esp_err_t ds18b20_group_convert(ds18b20_group_handle_t handle)
 {
     if (handle == NULL)
@@ -173,7 +486,12 @@ esp_err_t ds18b20_group_convert(ds18b20_group_handle_t handle)
         return ESP_ERR_INVALID_ARG;
     }
 
-    ds18b20_convert_all(handle->owb);
+    // Start conversion on all buses at once, so they run in parallel
+    for (size_t b = 0; b < handle->bus_count; b++)
+    {
+        ds18b20_convert_all(handle->buses[b]);
+    }
+    handle->conversion_start = esp_timer_get_time();
     return ESP_OK;
 }
 
@@ -188,8 +506,75 @@ esp_err_t ds18b20_group_wait_for_conversion(ds18b20_group_handle_t handle)
         return ESP_ERR_INVALID_STATE;
     }
 
-    // All should finish at same time
-    ds18b20_wait_for_conversion(&handle->devices[0]);
+    // Buses convert in parallel, so a single wait for the slowest device since conversion start covers all of them
+    int64_t end_us = (handle->conversion_start > 0 ? handle->conversion_start : esp_timer_get_time()) + (int64_t)ds18b20_group_conversion_time_ms(handle) * 1000;
+    int64_t remaining_us = end_us - esp_timer_get_time();
+    if (remaining_us > 0)
+    {
+        vTaskDelay(remaining_us / 1000 / portTICK_PERIOD_MS + 1);
+    }
+
+    // Each bus is polled once, device still converting holds the line low. Parasitic power gives no signal.
+    for (uint8_t b = 0; b < handle->bus_count; b++)
+    {
+        OneWireBus *owb = handle->buses[b];
+        uint8_t done = 1;
+        if (!owb->use_parasitic_power && owb_read_bit(owb, &done) == OWB_STATUS_OK && !done)
+        {
+            for (size_t i = 0; i < handle->count; i++)
+            {
+                if (handle->devices[i].bus == owb)
+                {
+                    ESP_LOGW(TAG, "conversion on bus %u still in progress", b);
+                    ds18b20_wait_for_conversion(&handle->devices[i]);
+                    break;
+                }
+            }
+        }
+    }
+    handle->conversion_start = 0;
+    return ESP_OK;
+}
+
+uint32_t ds18b20_group_conversion_time_ms(ds18b20_group_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return 0;
+    }
+
+    // Devices convert in parallel, so the slowest one determines the time
+    uint32_t time_ms = 0;
+    for (size_t i = 0; i < handle->count; i++)
+    {
+        uint32_t device_time_ms = ds18b20_resolution_conversion_time_ms(handle->devices[i].resolution);
+        if (device_time_ms > time_ms)
+        {
+            time_ms = device_time_ms;
+        }
+    }
+    return time_ms;
+}
+
+esp_err_t ds18b20_group_conversion_ready(ds18b20_group_handle_t handle, bool *ready)
+{
+    if (handle == NULL || ready == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->conversion_start == 0)
+    {
+        *ready = false;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t elapsed_us = esp_timer_get_time() - handle->conversion_start;
+    *ready = elapsed_us >= (int64_t)ds18b20_group_conversion_time_ms(handle) * 1000; // ms to us
+    if (*ready)
+    {
+        // Conversion is done, next call requires ds18b20_group_convert()
+        handle->conversion_start = 0;
+    }
     return ESP_OK;
 }
 
@@ -210,3 +595,152 @@ esp_err_t ds18b20_group_read_single(ds18b20_group_handle_t handle, uint8_t index
     ESP_LOGD(TAG, "readout %u: %.3f", index, *value_c);
     return ESP_OK;
 }
+
+static esp_err_t ds18b20_group_read_raw(const DS18B20_Info *device, int16_t *raw)
+{
+    // Whole command sequence is written at once - address (or skip it for solo device) + read scratchpad
+    uint8_t cmd[1 + sizeof(OneWireBus_ROMCode) + 1];
+    size_t cmd_len = 0;
+    if (device->solo)
+    {
+        cmd[cmd_len++] = OWB_ROM_SKIP;
+    }
+    else
+    {
+        cmd[cmd_len++] = OWB_ROM_MATCH;
+        memcpy(&cmd[cmd_len], device->rom_code.bytes, sizeof(device->rom_code.bytes));
+        cmd_len += sizeof(device->rom_code.bytes);
+    }
+    cmd[cmd_len++] = DS18B20_FUNCTION_SCRATCHPAD_READ;
+
+    bool present = false;
+    if (owb_reset(device->bus, &present) != OWB_STATUS_OK)
+    {
+        return ESP_FAIL;
+    }
+    if (!present)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (owb_write_bytes(device->bus, cmd, cmd_len) != OWB_STATUS_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    // Without CRC, only temperature LSB and MSB are needed, rest of the scratchpad is never clocked out,
+    // next bus reset terminates the read
+    uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE] = {};
+    size_t len = device->use_crc ? DS18B20_SCRATCHPAD_SIZE : 2;
+    if (owb_read_bytes(device->bus, scratchpad, len) != OWB_STATUS_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    if (device->use_crc)
+    {
+        // CRC of all zeroes is zero as well, that would be a false positive
+        bool all_zero = true;
+        for (size_t i = 0; i < len && all_zero; i++) all_zero = scratchpad[i] == 0;
+
+        if (all_zero || owb_crc8_bytes(0, scratchpad, len) != 0)
+        {
+            return ESP_ERR_INVALID_CRC;
+        }
+    }
+    else if (scratchpad[0] == 0xFF && scratchpad[1] == 0xFF)
+    {
+        // Nothing responded, bus is idle high
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    *raw = (int16_t)((scratchpad[1] << 8) | scratchpad[0]) & ds18b20_resolution_mask(device->resolution);
+    return ESP_OK;
+}
+
+esp_err_t ds18b20_group_read_all(ds18b20_group_handle_t handle, struct ds18b20_group_result *results, size_t results_len)
+{
+    if (handle == NULL || results == NULL || results_len < handle->count)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_OK;
+    for (uint8_t i = 0; i < handle->count; i++)
+    {
+        struct ds18b20_group_result *result = &results[i];
+
+        // Schedule, device that is gone would only burn bus time on retries
+        if (!handle->present[i])
+        {
+            result->fresh = false;
+            continue;
+        }
+        if (handle->read_countdowns[i] > 0)
+        {
+            handle->read_countdowns[i]--;
+            result->fresh = false;
+            continue;
+        }
+        handle->read_countdowns[i] = handle->read_periods[i] > 1 ? handle->read_periods[i] - 1 : 0;
+
+        int64_t start = esp_timer_get_time();
+
+        // Retry within same cycle, so a single glitch does not lose the reading
+        esp_err_t err = ESP_FAIL;
+        for (int attempt = 0; attempt <= DS18B20_GROUP_READ_RETRIES; attempt++)
+        {
+            err = ds18b20_group_read_raw(&handle->devices[i], &result->raw);
+            if (err != ESP_ERR_INVALID_CRC)
+            {
+                break;
+            }
+            ESP_LOGD(TAG, "crc error on sensor %u, attempt %d", i, attempt);
+        }
+
+        int64_t now = esp_timer_get_time();
+        result->status = err;
+        result->duration_us = (uint32_t)(now - start);
+        result->fresh = true;
+
+        if (err == ESP_OK)
+        {
+            result->timestamp = now;
+            result->value_c = (float)result->raw / 16.0f;
+            ESP_LOGD(TAG, "readout %u: %.3f in %u us", i, result->value_c, result->duration_us);
+        }
+        else
+        {
+            ESP_LOGW(TAG, "failed to read temperature for sensor %u: %d %s", i, err, esp_err_to_name(err));
+            ret = ESP_FAIL;
+        }
+    }
+
+    return ret;
+}
+
+esp_err_t ds18b20_group_set_read_period(ds18b20_group_handle_t handle, uint8_t index, uint16_t period)
+{
+    if (handle == NULL || index >= handle->count)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    handle->read_periods[index] = period;
+    if (handle->read_countdowns[index] >= period)
+    {
+        // Shortened, don't wait for the old period to pass
+        handle->read_countdowns[index] = period > 1 ? period - 1 : 0;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ds18b20_group_request_read(ds18b20_group_handle_t handle, uint8_t index)
+{
+    if (handle == NULL || index >= handle->count)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    handle->read_countdowns[index] = 0;
+    return ESP_OK;
+}
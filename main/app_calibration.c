@@ -0,0 +1,167 @@
+#include "app_calibration.h"
+#include <assert.h>
+#include <esp_log.h>
+#include <nvs.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "app_calibration";
+
+#define APP_CALIBRATION_VERSION 1
+#define APP_CALIBRATION_NVS_NAME "fans"
+#define APP_CALIBRATION_SETTLE_US 3000000LL   // Minimum time at each step, fans are slow to spin down
+#define APP_CALIBRATION_TIMEOUT_US 15000000LL // Maximum time at each step, for fans that never settle
+#define APP_CALIBRATION_STEADY_RPM 30         // Max change between two readings considered steady
+
+bool app_calibration_valid(const struct app_calibration *cal)
+{
+    return cal->version == APP_CALIBRATION_VERSION && cal->rpm[APP_CALIBRATION_POINTS - 1] > 0;
+}
+
+uint16_t app_calibration_rpm(const struct app_calibration *cal, float duty_percent)
+{
+    if (duty_percent * 100.0f < (float)cal->stall_duty)
+    {
+        return 0;
+    }
+
+    float x = duty_percent * (APP_CALIBRATION_POINTS - 1);
+    if (x <= 0)
+    {
+        return cal->rpm[0];
+    }
+    if (x >= APP_CALIBRATION_POINTS - 1)
+    {
+        return cal->rpm[APP_CALIBRATION_POINTS - 1];
+    }
+
+    size_t i = (size_t)x;
+    float frac = x - (float)i;
+    return (uint16_t)((float)cal->rpm[i] + frac * ((float)cal->rpm[i + 1] - (float)cal->rpm[i]));
+}
+
+float app_calibration_duty(const struct app_calibration *cal, uint16_t rpm)
+{
+    float stall_duty = (float)cal->stall_duty / 100.0f;
+
+    for (size_t i = 1; i < APP_CALIBRATION_POINTS; i++)
+    {
+        if (cal->rpm[i] >= rpm)
+        {
+            // Interpolate within the step, table is monotonic apart from measurement noise
+            float duty = (float)(i - 1) / (APP_CALIBRATION_POINTS - 1);
+            if (cal->rpm[i] > cal->rpm[i - 1] && rpm > cal->rpm[i - 1])
+            {
+                duty += (float)(rpm - cal->rpm[i - 1]) / (float)(cal->rpm[i] - cal->rpm[i - 1]) / (APP_CALIBRATION_POINTS - 1);
+            }
+            return duty > stall_duty ? duty : stall_duty;
+        }
+    }
+    return 1.0f;
+}
+
+void app_calibration_sweep_start(struct app_calibration_sweep *sweep, int64_t now)
+{
+    assert(sweep);
+
+    memset(sweep, 0, sizeof(*sweep));
+    sweep->active = true;
+    sweep->step_start = now;
+}
+
+bool app_calibration_sweep_update(struct app_calibration_sweep *sweep, uint16_t rpm, int64_t now, float *duty_percent)
+{
+    assert(sweep);
+    assert(duty_percent);
+
+    if (!sweep->active)
+    {
+        return false;
+    }
+
+    // Steps go from full speed down, so the stall point is found last
+    size_t point = APP_CALIBRATION_POINTS - 1 - sweep->step;
+    *duty_percent = (float)point / (APP_CALIBRATION_POINTS - 1);
+
+    int64_t elapsed = now - sweep->step_start;
+    bool steady = elapsed >= APP_CALIBRATION_SETTLE_US && abs((int)rpm - (int)sweep->last_rpm) <= APP_CALIBRATION_STEADY_RPM;
+    sweep->last_rpm = rpm;
+    if (!steady && elapsed < APP_CALIBRATION_TIMEOUT_US)
+    {
+        return true;
+    }
+
+    // Record steady state
+    ESP_LOGI(TAG, "duty %u%% rpm %u", (unsigned int)(point * 100 / (APP_CALIBRATION_POINTS - 1)), rpm);
+    sweep->result.rpm[point] = rpm;
+
+    if (rpm == 0 || point == 0)
+    {
+        // Stalled, all lower steps stay at zero
+        size_t stall_point = rpm == 0 ? point + 1 : 0;
+        sweep->result.stall_duty = stall_point < APP_CALIBRATION_POINTS ? (uint8_t)(stall_point * 100 / (APP_CALIBRATION_POINTS - 1)) : 100;
+        sweep->result.version = APP_CALIBRATION_VERSION;
+        sweep->active = false;
+        ESP_LOGI(TAG, "calibration finished, stall duty %u%%", sweep->result.stall_duty);
+        return false;
+    }
+
+    sweep->step++;
+    sweep->step_start = now;
+    return true;
+}
+
+esp_err_t app_calibration_load(struct app_calibration *cal, const char *key)
+{
+    assert(cal);
+    assert(key);
+
+    nvs_handle_t handle = 0;
+    esp_err_t err = nvs_open(APP_CALIBRATION_NVS_NAME, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    struct app_calibration value = {};
+    size_t len = sizeof(value);
+    err = nvs_get_blob(handle, key, &value, &len);
+    nvs_close(handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (len != sizeof(value) || value.version != APP_CALIBRATION_VERSION)
+    {
+        ESP_LOGW(TAG, "ignoring incompatible calibration %s", key);
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    *cal = value;
+    return ESP_OK;
+}
+
+esp_err_t app_calibration_store(const struct app_calibration *cal, const char *key)
+{
+    assert(cal);
+    assert(key);
+
+    nvs_handle_t handle = 0;
+    esp_err_t err = nvs_open(APP_CALIBRATION_NVS_NAME, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "nvs_open(%s) failed: %d %s", APP_CALIBRATION_NVS_NAME, err, esp_err_to_name(err));
+        return err;
+    }
+    err = nvs_set_blob(handle, key, cal, sizeof(*cal));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "failed to store calibration %s: %d %s", key, err, esp_err_to_name(err));
+    }
+    nvs_close(handle);
+    return err;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_CALIBRATION_POINTS 11 // Duty 0%, 10%, ... 100%
+
+/**
+ * Measured duty to RPM table of single fan, stored in NVS as is.
+ */
+struct app_calibration
+{
+    uint8_t version;
+    uint8_t stall_duty;                   // Lowest duty in % at which the fan still spins
+    uint16_t rpm[APP_CALIBRATION_POINTS]; // Steady-state RPM at given duty step
+};
+
+/**
+ * Sweep state, duty is stepped down from 100% and steady-state RPM is recorded at each step.
+ */
+struct app_calibration_sweep
+{
+    bool active;
+    size_t step;
+    int64_t step_start;
+    uint16_t last_rpm;
+    struct app_calibration result;
+};
+
+bool app_calibration_valid(const struct app_calibration *cal);
+
+/**
+ * Expected RPM at given duty, interpolated from the table.
+ */
+uint16_t app_calibration_rpm(const struct app_calibration *cal, float duty_percent);
+
+/**
+ * Lowest duty reaching given RPM, inverse of app_calibration_rpm(). It is never below the stall duty.
+ */
+float app_calibration_duty(const struct app_calibration *cal, uint16_t rpm);
+
+void app_calibration_sweep_start(struct app_calibration_sweep *sweep, int64_t now);
+
+/**
+ * Advances the sweep, to be called periodically with current RPM.
+ *
+ * @param sweep Sweep state
+ * @param rpm Measured RPM
+ * @param now Current time in us
+ * @param duty_percent Duty to be written to the fan
+ * @return true while sweep is running, false once it is finished and result is complete.
+ */
+bool app_calibration_sweep_update(struct app_calibration_sweep *sweep, uint16_t rpm, int64_t now, float *duty_percent);
+
+/**
+ * Loads table from NVS.
+ *
+ * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND when fan was not calibrated yet.
+ */
+esp_err_t app_calibration_load(struct app_calibration *cal, const char *key);
+
+esp_err_t app_calibration_store(const struct app_calibration *cal, const char *key);
+
+#ifdef __cplusplus
+}
+#endif
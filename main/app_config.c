@@ -0,0 +1,216 @@
+#include "app_config.h"
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "app_config";
+
+#define APP_CONFIG_COMMIT_DELAY_US (CONFIG_APP_CONFIG_COMMIT_DELAY * 1000LL)
+
+struct app_config_entry
+{
+    char key[APP_CONFIG_KEY_LEN];
+    void *data; // Owned by the entry
+    size_t len;
+};
+
+static const char *config_nvs_name = NULL;
+static struct app_config_entry config_pending[APP_CONFIG_MAX_PENDING] = {};
+static size_t config_pending_count = 0;
+static int64_t config_changed = 0; // Time of last queued value
+static SemaphoreHandle_t config_mutex = NULL;
+static SemaphoreHandle_t config_flush_mutex = NULL;
+
+// Entries being written, so setters are not blocked by flash
+static struct app_config_entry config_flushing[APP_CONFIG_MAX_PENDING] = {};
+
+static void app_config_entry_free(struct app_config_entry *entry)
+{
+    free(entry->data);
+    entry->data = NULL;
+}
+
+static void app_config_shutdown()
+{
+    app_config_flush();
+}
+
+esp_err_t app_config_init(const char *nvs_name)
+{
+    if (nvs_name == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config_mutex != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    config_mutex = xSemaphoreCreateMutex();
+    config_flush_mutex = xSemaphoreCreateMutex();
+    if (config_mutex == NULL || config_flush_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    config_nvs_name = nvs_name;
+    return esp_register_shutdown_handler(app_config_shutdown);
+}
+
+static esp_err_t app_config_queue(const struct app_config_entry *entry)
+{
+    if (config_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (;;)
+    {
+        xSemaphoreTake(config_mutex, portMAX_DELAY);
+
+        // Newer value replaces pending one
+        size_t i = 0;
+        while (i < config_pending_count && strcmp(config_pending[i].key, entry->key) != 0)
+        {
+            i++;
+        }
+        if (i < APP_CONFIG_MAX_PENDING)
+        {
+            if (i < config_pending_count)
+            {
+                app_config_entry_free(&config_pending[i]);
+            }
+            config_pending[i] = *entry;
+            config_pending_count = i < config_pending_count ? config_pending_count : i + 1;
+            config_changed = esp_timer_get_time();
+            xSemaphoreGive(config_mutex);
+            return ESP_OK;
+        }
+
+        // Full, which takes a lot of distinct keys in one burst, make room synchronously
+        xSemaphoreGive(config_mutex);
+        esp_err_t err = app_config_flush();
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+}
+
+esp_err_t app_config_set_blob(const char *key, const void *data, size_t len)
+{
+    if (key == NULL || data == NULL || strlen(key) >= APP_CONFIG_KEY_LEN)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct app_config_entry entry = {.len = len};
+    strlcpy(entry.key, key, sizeof(entry.key));
+    entry.data = malloc(len > 0 ? len : 1);
+    if (entry.data == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(entry.data, data, len);
+
+    esp_err_t err = app_config_queue(&entry);
+    if (err != ESP_OK)
+    {
+        app_config_entry_free(&entry);
+    }
+    return err;
+}
+
+esp_err_t app_config_flush()
+{
+    if (config_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(config_flush_mutex, portMAX_DELAY);
+
+    // Take everything pending
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    size_t count = config_pending_count;
+    memcpy(config_flushing, config_pending, count * sizeof(*config_pending));
+    config_pending_count = 0;
+    xSemaphoreGive(config_mutex);
+
+    if (count == 0)
+    {
+        xSemaphoreGive(config_flush_mutex);
+        return ESP_OK;
+    }
+
+    nvs_handle_t handle = 0;
+    esp_err_t err = nvs_open(config_nvs_name, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        for (size_t i = 0; i < count && err == ESP_OK; i++)
+        {
+            err = nvs_set_blob(handle, config_flushing[i].key, config_flushing[i].data, config_flushing[i].len);
+        }
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "committed %u values to %s", (unsigned int)count, config_nvs_name);
+        for (size_t i = 0; i < count; i++)
+        {
+            app_config_entry_free(&config_flushing[i]);
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "failed to commit %u values to %s: %d %s", (unsigned int)count, config_nvs_name, err, esp_err_to_name(err));
+
+        // Put back what was not overwritten meanwhile, so next flush retries it
+        xSemaphoreTake(config_mutex, portMAX_DELAY);
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t k = 0;
+            while (k < config_pending_count && strcmp(config_pending[k].key, config_flushing[i].key) != 0)
+            {
+                k++;
+            }
+            if (k == config_pending_count && k < APP_CONFIG_MAX_PENDING)
+            {
+                config_pending[config_pending_count++] = config_flushing[i];
+            }
+            else
+            {
+                app_config_entry_free(&config_flushing[i]);
+            }
+        }
+        config_changed = esp_timer_get_time();
+        xSemaphoreGive(config_mutex);
+    }
+
+    xSemaphoreGive(config_flush_mutex);
+    return err;
+}
+
+esp_err_t app_config_flush_idle()
+{
+    if (config_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    bool due = config_pending_count > 0 && esp_timer_get_time() - config_changed >= APP_CONFIG_COMMIT_DELAY_US;
+    xSemaphoreGive(config_mutex);
+
+    return due ? app_config_flush() : ESP_OK;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_CONFIG_MAX_PENDING 32
+#define APP_CONFIG_KEY_LEN 16 // NVS_KEY_NAME_MAX_SIZE
+
+/**
+ * Write-back store of config values in single NVS namespace. Callers keep the values in RAM themselves,
+ * setters only queue them and return right away. Queued values are written in one commit, once there was
+ * no change for CONFIG_APP_CONFIG_COMMIT_DELAY, or on restart. Repeated writes of the same key are coalesced.
+ *
+ * @param nvs_name NVS namespace, must be valid for the program lifetime
+ */
+esp_err_t app_config_init(const char *nvs_name);
+
+/**
+ * Queues binary value, data is copied.
+ */
+esp_err_t app_config_set_blob(const char *key, const void *data, size_t len);
+
+/**
+ * Writes queued values if the quiet period has elapsed. Meant to be called periodically.
+ */
+esp_err_t app_config_flush_idle();
+
+/**
+ * Writes all queued values and commits them now.
+ */
+esp_err_t app_config_flush();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,182 @@
+#include "app_curve.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static float app_curve_interpolate(const struct app_curve_point *points, size_t count, float temperature_c)
+{
+    if (temperature_c <= points[0].temperature_c)
+    {
+        return points[0].duty_percent;
+    }
+    for (size_t i = 1; i < count; i++)
+    {
+        if (temperature_c <= points[i].temperature_c)
+        {
+            const struct app_curve_point *a = &points[i - 1];
+            const struct app_curve_point *b = &points[i];
+            return a->duty_percent + (temperature_c - a->temperature_c) * (b->duty_percent - a->duty_percent) / (b->temperature_c - a->temperature_c);
+        }
+    }
+    return points[count - 1].duty_percent;
+}
+
+void app_curve_init(struct app_curve *curve)
+{
+    assert(curve);
+
+    memset(curve, 0, sizeof(*curve));
+    curve->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+}
+
+esp_err_t app_curve_set_points(struct app_curve *curve, const struct app_curve_point *points, size_t count)
+{
+    if (curve == NULL || points == NULL || count < 2 || count > APP_CURVE_MAX_POINTS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (points[i].duty_percent < 0 || points[i].duty_percent > 1 || (i > 0 && points[i].temperature_c <= points[i - 1].temperature_c))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    // Build table outside of the lock
+    float lut[APP_CURVE_LUT_SIZE];
+    float min_c = points[0].temperature_c;
+    float step_c = (points[count - 1].temperature_c - min_c) / (APP_CURVE_LUT_SIZE - 1);
+    for (size_t i = 0; i < APP_CURVE_LUT_SIZE; i++)
+    {
+        lut[i] = app_curve_interpolate(points, count, min_c + step_c * (float)i);
+    }
+
+    portENTER_CRITICAL(&curve->lock);
+    memcpy(curve->points, points, count * sizeof(*points));
+    curve->count = count;
+    curve->lut_min_c = min_c;
+    curve->lut_step_c = step_c;
+    memcpy(curve->lut, lut, sizeof(lut));
+    portEXIT_CRITICAL(&curve->lock);
+
+    return ESP_OK;
+}
+
+void app_curve_set_hysteresis(struct app_curve *curve, float hysteresis_c)
+{
+    curve->hysteresis_c = hysteresis_c > 0 ? hysteresis_c : 0;
+}
+
+void app_curve_set_slew_rate(struct app_curve *curve, float slew_rate)
+{
+    curve->slew_rate = slew_rate > 0 ? slew_rate : 0;
+}
+
+esp_err_t app_curve_parse(const char *str, struct app_curve_point *points, size_t *count)
+{
+    if (str == NULL || points == NULL || count == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t n = 0;
+    const char *p = str;
+    while (*p)
+    {
+        if (n >= APP_CURVE_MAX_POINTS)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        char *end = NULL;
+        float temperature_c = strtof(p, &end);
+        if (end == p || *end != ':')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        p = end + 1;
+
+        float duty = strtof(p, &end);
+        if (end == p || (*end != ',' && *end != '\0'))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        p = *end == ',' ? end + 1 : end;
+
+        points[n++] = (struct app_curve_point){.temperature_c = temperature_c, .duty_percent = duty / 100.0f};
+    }
+
+    *count = n;
+    return n >= 2 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+float app_curve_lookup(struct app_curve *curve, float temperature_c)
+{
+    portENTER_CRITICAL(&curve->lock);
+
+    float result = 0;
+    if (curve->count > 0)
+    {
+        float pos = curve->lut_step_c > 0 ? (temperature_c - curve->lut_min_c) / curve->lut_step_c : 0;
+        if (pos <= 0)
+        {
+            result = curve->lut[0];
+        }
+        else if (pos >= APP_CURVE_LUT_SIZE - 1)
+        {
+            result = curve->lut[APP_CURVE_LUT_SIZE - 1];
+        }
+        else
+        {
+            size_t i = (size_t)pos;
+            float frac = pos - (float)i;
+            result = curve->lut[i] + frac * (curve->lut[i + 1] - curve->lut[i]);
+        }
+    }
+
+    portEXIT_CRITICAL(&curve->lock);
+    return result;
+}
+
+float app_curve_update(struct app_curve *curve, float temperature_c, float dt_s)
+{
+    // Deadband, small jitter does not move the input at all
+    if (!curve->initialized || fabsf(temperature_c - curve->input_c) > curve->hysteresis_c)
+    {
+        curve->input_c = temperature_c;
+    }
+
+    float target = app_curve_lookup(curve, curve->input_c);
+    if (!curve->initialized)
+    {
+        curve->output = target;
+        curve->initialized = true;
+        return target;
+    }
+
+    // Slew-rate limit
+    float max_step = curve->slew_rate * dt_s;
+    if (curve->slew_rate > 0 && fabsf(target - curve->output) > max_step)
+    {
+        curve->output += target > curve->output ? max_step : -max_step;
+    }
+    else
+    {
+        curve->output = target;
+    }
+    return curve->output;
+}
+
+float app_curve_distance(struct app_curve *curve, float temperature_c)
+{
+    portENTER_CRITICAL(&curve->lock);
+    float distance_c = INFINITY;
+    for (size_t i = 0; i < curve->count; i++)
+    {
+        distance_c = fminf(distance_c, fabsf(temperature_c - curve->points[i].temperature_c));
+    }
+    portEXIT_CRITICAL(&curve->lock);
+    return distance_c;
+}
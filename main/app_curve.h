@@ -0,0 +1,90 @@
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_CURVE_MAX_POINTS 8
+#define APP_CURVE_LUT_SIZE 64
+
+struct app_curve_point
+{
+    float temperature_c;
+    float duty_percent; // 0..1
+};
+
+/**
+ * Piecewise-linear fan curve, precomputed into a lookup table, with input hysteresis and output slew-rate limit.
+ * Configuration can be changed from other tasks while the curve is in use.
+ */
+struct app_curve
+{
+    portMUX_TYPE lock;
+
+    // Config
+    struct app_curve_point points[APP_CURVE_MAX_POINTS];
+    size_t count;
+    float hysteresis_c;
+    float slew_rate; // Max duty change per second, 0 for unlimited
+    float lut_min_c;
+    float lut_step_c;
+    float lut[APP_CURVE_LUT_SIZE];
+
+    // State
+    bool initialized;
+    float input_c;
+    float output;
+};
+
+void app_curve_init(struct app_curve *curve);
+
+/**
+ * Sets curve points and rebuilds the lookup table.
+ *
+ * @param curve Curve
+ * @param points Points, sorted by temperature, strictly increasing
+ * @param count Number of points, 2 to APP_CURVE_MAX_POINTS
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid points.
+ */
+esp_err_t app_curve_set_points(struct app_curve *curve, const struct app_curve_point *points, size_t count);
+
+void app_curve_set_hysteresis(struct app_curve *curve, float hysteresis_c);
+
+void app_curve_set_slew_rate(struct app_curve *curve, float slew_rate);
+
+/**
+ * Parses points in "temp:duty,temp:duty,..." format, where duty is in %, e.g. "25:50,30:60,35:90".
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on malformed string.
+ */
+esp_err_t app_curve_parse(const char *str, struct app_curve_point *points, size_t *count);
+
+/**
+ * Pure lookup, without hysteresis and slew-rate limit.
+ */
+float app_curve_lookup(struct app_curve *curve, float temperature_c);
+
+/**
+ * Computes next output. Input is held until temperature moves by more than hysteresis,
+ * and output change is limited by slew rate.
+ *
+ * @param curve Curve
+ * @param temperature_c Current temperature
+ * @param dt_s Time since last update
+ * @return Duty 0..1
+ */
+float app_curve_update(struct app_curve *curve, float temperature_c, float dt_s);
+
+/**
+ * Distance of the temperature to nearest curve point, where precision matters most.
+ */
+float app_curve_distance(struct app_curve *curve, float temperature_c);
+
+#ifdef __cplusplus
+}
+#endif
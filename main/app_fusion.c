@@ -0,0 +1,154 @@
+#include "app_fusion.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define APP_FUSION_MAX_RATE_C (CONFIG_APP_SENSOR_MAX_RATE_MC / 1000.0f)
+#define APP_FUSION_ALPHA (CONFIG_APP_SENSOR_FILTER_ALPHA / 100.0f)
+#define APP_FUSION_MARGIN_C 0.5f   // Lower resolutions and conversion jitter
+#define APP_FUSION_MAX_REJECTED 3 // Then it is a real step, e.g. probe was moved
+
+void app_fusion_sensor_reset(struct app_fusion_sensor *sensor)
+{
+    assert(sensor);
+    uint32_t rejected = sensor->rejected;
+    memset(sensor, 0, sizeof(*sensor));
+    sensor->rejected = rejected;
+}
+
+static float app_fusion_median(const struct app_fusion_sensor *sensor)
+{
+    if (sensor->sample_count < APP_FUSION_MEDIAN_SIZE)
+    {
+        // Not enough samples yet, newest one
+        return sensor->samples[(sensor->sample_next + APP_FUSION_MEDIAN_SIZE - 1) % APP_FUSION_MEDIAN_SIZE];
+    }
+
+    float a = sensor->samples[0];
+    float b = sensor->samples[1];
+    float c = sensor->samples[2];
+    return fmaxf(fminf(a, b), fminf(fmaxf(a, b), c));
+}
+
+bool app_fusion_sensor_update(struct app_fusion_sensor *sensor, float raw_c, int64_t now)
+{
+    assert(sensor);
+
+    if (sensor->timestamp > 0)
+    {
+        // Rate-of-change limit against last accepted sample
+        float last_c = sensor->samples[(sensor->sample_next + APP_FUSION_MEDIAN_SIZE - 1) % APP_FUSION_MEDIAN_SIZE];
+        float dt_s = (float)(now - sensor->timestamp) / 1000000.0f;
+        if (fabsf(raw_c - last_c) > APP_FUSION_MAX_RATE_C * dt_s + APP_FUSION_MARGIN_C)
+        {
+            sensor->rejected++;
+            if (++sensor->rejected_in_row < APP_FUSION_MAX_REJECTED)
+            {
+                return false;
+            }
+            // Consistently different, start over from new value
+            app_fusion_sensor_reset(sensor);
+        }
+    }
+    sensor->rejected_in_row = 0;
+
+    sensor->samples[sensor->sample_next] = raw_c;
+    sensor->sample_next = (sensor->sample_next + 1) % APP_FUSION_MEDIAN_SIZE;
+    if (sensor->sample_count < APP_FUSION_MEDIAN_SIZE)
+    {
+        sensor->sample_count++;
+    }
+
+    float median_c = app_fusion_median(sensor);
+    sensor->value_c = sensor->timestamp > 0 ? sensor->value_c + APP_FUSION_ALPHA * (median_c - sensor->value_c) : median_c;
+    sensor->timestamp = now;
+    return true;
+}
+
+bool app_fusion_sensor_valid(const struct app_fusion_sensor *sensor, int64_t now, int64_t max_age_us)
+{
+    return sensor->timestamp > 0 && now - sensor->timestamp <= max_age_us;
+}
+
+bool app_fusion_combine(enum app_fusion_policy policy, const struct app_fusion_source *sources, size_t count,
+                        const float *values_c, const bool *valid, float *result_c)
+{
+    float max_c = -INFINITY;
+    float sum = 0;
+    float weights = 0;
+    bool any = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t index = sources[i].index;
+        if (!valid[index])
+        {
+            continue;
+        }
+        any = true;
+        max_c = fmaxf(max_c, values_c[index]);
+        sum += sources[i].weight * values_c[index];
+        weights += sources[i].weight;
+    }
+
+    if (!any)
+    {
+        return false;
+    }
+    *result_c = policy == APP_FUSION_MEAN && weights > 0 ? sum / weights : max_c;
+    return true;
+}
+
+esp_err_t app_fusion_parse_sources(const char *str, const char *const *addresses, size_t address_count,
+                                   struct app_fusion_source *sources, size_t *count)
+{
+    if (str == NULL || addresses == NULL || sources == NULL || count == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t n = 0;
+    const char *p = str;
+    while (*p)
+    {
+        if (n >= APP_FUSION_MAX_SOURCES)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        size_t len = strcspn(p, ":,");
+        size_t index = 0;
+        while (index < address_count && (strlen(addresses[index]) != len || strncmp(addresses[index], p, len) != 0))
+        {
+            index++;
+        }
+        if (index >= address_count)
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+        p += len;
+
+        float weight = 1.0f;
+        if (*p == ':')
+        {
+            char *end = NULL;
+            weight = strtof(p + 1, &end);
+            if (end == p + 1 || weight < 0)
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+            p = end;
+        }
+        if (*p != ',' && *p != '\0')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        p = *p == ',' ? p + 1 : p;
+
+        sources[n++] = (struct app_fusion_source){.index = index, .weight = weight};
+    }
+
+    *count = n;
+    return n > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_FUSION_MAX_SOURCES 4
+#define APP_FUSION_MEDIAN_SIZE 3
+
+/**
+ * How temperatures of zone sources are combined.
+ */
+enum app_fusion_policy
+{
+    APP_FUSION_MAX,       // Hottest sensor drives the zone
+    APP_FUSION_MEAN,      // Weighted mean of all sensors
+    APP_FUSION_CURVE_MAX, // Each sensor through its own curve, highest duty wins
+};
+
+struct app_fusion_source
+{
+    size_t index; // Sensor index
+    float weight;
+};
+
+/**
+ * Filter of single sensor. Samples changing faster than physically plausible are rejected,
+ * rest goes through median and exponential moving average.
+ */
+struct app_fusion_sensor
+{
+    float samples[APP_FUSION_MEDIAN_SIZE];
+    size_t sample_count;
+    size_t sample_next;
+    float value_c;     // Filtered value
+    int64_t timestamp; // Time of last accepted sample, 0 if none
+    uint8_t rejected_in_row;
+    uint32_t rejected;
+};
+
+void app_fusion_sensor_reset(struct app_fusion_sensor *sensor);
+
+/**
+ * Feeds successful read into the filter.
+ *
+ * @return true if accepted, false if rejected as outlier.
+ */
+bool app_fusion_sensor_update(struct app_fusion_sensor *sensor, float raw_c, int64_t now);
+
+/**
+ * Sensor is valid when it has accepted sample not older than max_age_us.
+ */
+bool app_fusion_sensor_valid(const struct app_fusion_sensor *sensor, int64_t now, int64_t max_age_us);
+
+/**
+ * Combines valid sources into single temperature, used by APP_FUSION_MAX and APP_FUSION_MEAN.
+ *
+ * @return true if at least one source was valid.
+ */
+bool app_fusion_combine(enum app_fusion_policy policy, const struct app_fusion_source *sources, size_t count,
+                        const float *values_c, const bool *valid, float *result_c);
+
+/**
+ * Parses sources in "address[:weight],..." format, weight defaults to 1.
+ *
+ * @param str Sources string
+ * @param addresses Addresses of all sensors, index in this array is the sensor index
+ * @param address_count Number of sensors
+ * @param sources Parsed sources, APP_FUSION_MAX_SOURCES long
+ * @param count Number of parsed sources
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on malformed string, ESP_ERR_NOT_FOUND on unknown address.
+ */
+esp_err_t app_fusion_parse_sources(const char *str, const char *const *addresses, size_t address_count,
+                                   struct app_fusion_source *sources, size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
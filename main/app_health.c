@@ -0,0 +1,94 @@
+#include "app_health.h"
+#include <assert.h>
+#include <string.h>
+
+#define APP_HEALTH_DEGRADED_RATIO (CONFIG_APP_HEALTH_DEGRADED_PERCENT / 100.0f)
+#define APP_HEALTH_RECOVERED_RATIO (APP_HEALTH_DEGRADED_RATIO + 0.05f)
+#define APP_HEALTH_TAU_S 3600.0f       // Degradation is slow, average over hours
+#define APP_HEALTH_SETTLE_US 5000000LL // Fan needs some time to reach new speed
+#define APP_HEALTH_SETTLE_DUTY 0.05f   // Smaller duty changes do not restart settling
+#define APP_HEALTH_MIN_DUTY 0.3f       // Without calibration, fan is expected to spin above this
+
+void app_health_init(struct app_health *health)
+{
+    assert(health);
+
+    memset(health, 0, sizeof(*health));
+    health->status = APP_HEALTH_OK;
+    health->ratio = 1.0f;
+}
+
+bool app_health_update(struct app_health *health, float duty_percent, uint16_t rpm, const struct app_calibration *cal, int64_t now, float dt_s)
+{
+    assert(health);
+    assert(cal);
+
+    bool calibrated = app_calibration_valid(cal);
+    uint16_t expected = calibrated ? app_calibration_rpm(cal, duty_percent) : (duty_percent >= APP_HEALTH_MIN_DUTY ? 1 : 0);
+
+    if (health->settle_start == 0 || duty_percent > health->settle_duty + APP_HEALTH_SETTLE_DUTY || duty_percent < health->settle_duty - APP_HEALTH_SETTLE_DUTY)
+    {
+        health->settle_duty = duty_percent;
+        health->settle_start = now;
+    }
+    bool settled = now - health->settle_start >= APP_HEALTH_SETTLE_US;
+
+    // Running fan that stops is a stall right away, fan starting up only once it had time to spin up
+    bool stopped = expected > 0 && rpm == 0 && (settled || health->last_rpm > 0);
+    health->last_rpm = rpm;
+
+    // Long-term ratio, only from steady state, since acceleration takes a while
+    if (calibrated && settled && expected > 0 && rpm > 0)
+    {
+        float alpha = dt_s / APP_HEALTH_TAU_S;
+        health->ratio += (alpha < 1.0f ? alpha : 1.0f) * ((float)rpm / (float)expected - health->ratio);
+    }
+
+    enum app_health_status status = health->status;
+    if (stopped)
+    {
+        status = APP_HEALTH_STALLED;
+    }
+    else if (rpm > 0 || expected == 0)
+    {
+        // Hysteresis, so averaged ratio around threshold does not flap
+        if (health->ratio < APP_HEALTH_DEGRADED_RATIO)
+        {
+            status = APP_HEALTH_DEGRADED;
+        }
+        else if (status == APP_HEALTH_STALLED || health->ratio >= APP_HEALTH_RECOVERED_RATIO)
+        {
+            status = APP_HEALTH_OK;
+        }
+    }
+
+    if (status == health->status)
+    {
+        return false;
+    }
+    if (status == APP_HEALTH_STALLED)
+    {
+        health->stalls++;
+    }
+    health->status = status;
+    return true;
+}
+
+float app_health_value(const struct app_health *health)
+{
+    return health->status == APP_HEALTH_STALLED ? 0.0f : health->ratio;
+}
+
+const char *app_health_status_name(enum app_health_status status)
+{
+    switch (status)
+    {
+    case APP_HEALTH_OK:
+        return "ok";
+    case APP_HEALTH_DEGRADED:
+        return "degraded";
+    case APP_HEALTH_STALLED:
+        return "stalled";
+    }
+    return "unknown";
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "app_calibration.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum app_health_status
+{
+    APP_HEALTH_OK,
+    APP_HEALTH_DEGRADED,
+    APP_HEALTH_STALLED,
+};
+
+/**
+ * Fan health monitor, compares measured RPM with RPM expected for commanded duty.
+ */
+struct app_health
+{
+    enum app_health_status status;
+    float ratio; // Long-term average of measured to expected RPM, 1 for healthy fan
+    uint32_t stalls;
+
+    // State
+    float settle_duty;
+    int64_t settle_start;
+    uint16_t last_rpm;
+};
+
+void app_health_init(struct app_health *health);
+
+/**
+ * Evaluates single measurement, to be called every control cycle.
+ *
+ * Stall is detected as soon as the tachometer reports stopped fan, which was commanded to spin.
+ * Degradation is detected from slow moving average of RPM ratio, it needs calibration.
+ *
+ * @param health Monitor
+ * @param duty_percent Commanded duty
+ * @param rpm Measured RPM
+ * @param cal Calibration of the fan, might not be valid
+ * @param now Current time in us
+ * @param dt_s Time since last update
+ * @return true when status changed.
+ */
+bool app_health_update(struct app_health *health, float duty_percent, uint16_t rpm, const struct app_calibration *cal, int64_t now, float dt_s);
+
+/**
+ * Health gauge, 0 for stalled fan, otherwise average RPM ratio.
+ */
+float app_health_value(const struct app_health *health);
+
+const char *app_health_status_name(enum app_health_status status);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,335 @@
+#include "app_history.h"
+#include "util/util_chunked.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char TAG[] = "app_history";
+
+#define APP_HISTORY_SIZE (CONFIG_APP_HISTORY_SIZE_KB * 1024)
+#define APP_HISTORY_BLOCK_SIZE 512
+#define APP_HISTORY_BLOCK_COUNT (APP_HISTORY_SIZE / APP_HISTORY_BLOCK_SIZE)
+#define APP_HISTORY_VARINT_MAX 10
+#define APP_HISTORY_SAMPLE_MAX ((APP_HISTORY_MAX_CHANNELS + 1) * APP_HISTORY_VARINT_MAX)
+#define APP_HISTORY_MISSING INT32_MIN // Stored instead of NAN, outside of any scaled value
+
+struct app_history_block
+{
+    int64_t start_ms;
+    uint16_t len;   // Used bytes of data
+    uint16_t count; // Number of samples
+    uint8_t channels;
+    uint8_t data[APP_HISTORY_BLOCK_SIZE - 16];
+};
+
+_Static_assert(APP_HISTORY_SAMPLE_MAX <= sizeof(((struct app_history_block *)0)->data), "history sample does not fit into block");
+_Static_assert(APP_HISTORY_MAX_CHANNELS <= UINT8_MAX, "history channel count does not fit into block");
+
+// Encoder/decoder state, reset on start of every block, so each block can be decoded on its own
+struct app_history_state
+{
+    int64_t ts;
+    int64_t ts_delta;
+    int64_t values[APP_HISTORY_MAX_CHANNELS];
+};
+
+static struct app_history_channel history_channels[APP_HISTORY_MAX_CHANNELS] = {};
+static size_t history_channel_count = 0;
+static struct app_history_block *history_blocks = NULL;
+static size_t history_head = 0; // Block being written
+static size_t history_used = 0; // Number of blocks with data
+static struct app_history_state history_state = {};
+static SemaphoreHandle_t history_mutex = NULL;
+
+// Scratch copy of a block for the HTTP handler, httpd runs handlers on one task, so it does not need to be on the stack
+static struct app_history_block history_read_block;
+
+inline static uint64_t zigzag_encode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline static int64_t zigzag_decode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static size_t varint_encode(uint8_t *dst, int64_t value)
+{
+    uint64_t v = zigzag_encode(value);
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        dst[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    dst[n++] = (uint8_t)v;
+    return n;
+}
+
+static size_t varint_decode(const uint8_t *src, size_t len, int64_t *value)
+{
+    uint64_t v = 0;
+    for (size_t n = 0; n < len && n < APP_HISTORY_VARINT_MAX; n++)
+    {
+        v |= (uint64_t)(src[n] & 0x7F) << (7 * n);
+        if ((src[n] & 0x80) == 0)
+        {
+            *value = zigzag_decode(v);
+            return n + 1;
+        }
+    }
+    return 0; // Corrupted
+}
+
+static size_t app_history_encode(uint8_t *dst, struct app_history_state *state, int64_t timestamp_ms, const int64_t *values)
+{
+    size_t n = 0;
+
+    // Samples are periodic, so delta-of-delta of the timestamp is mostly zero, one byte
+    int64_t ts_delta = timestamp_ms - state->ts;
+    n += varint_encode(&dst[n], ts_delta - state->ts_delta);
+    state->ts = timestamp_ms;
+    state->ts_delta = ts_delta;
+
+    // Values change slowly, so their deltas are small
+    for (size_t i = 0; i < history_channel_count; i++)
+    {
+        n += varint_encode(&dst[n], values[i] - state->values[i]);
+        state->values[i] = values[i];
+    }
+    return n;
+}
+
+static void app_history_start_block(int64_t timestamp_ms)
+{
+    if (history_used > 0)
+    {
+        history_head = (history_head + 1) % APP_HISTORY_BLOCK_COUNT;
+    }
+    if (history_used < APP_HISTORY_BLOCK_COUNT)
+    {
+        history_used++;
+    }
+
+    struct app_history_block *block = &history_blocks[history_head];
+    block->start_ms = timestamp_ms;
+    block->len = 0;
+    block->count = 0;
+    block->channels = (uint8_t)history_channel_count;
+
+    memset(&history_state, 0, sizeof(history_state));
+    history_state.ts = timestamp_ms;
+}
+
+esp_err_t app_history_init(const struct app_history_channel *channels, size_t count)
+{
+    if (channels == NULL || count == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (count > APP_HISTORY_MAX_CHANNELS)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (!history_blocks)
+    {
+        history_blocks = calloc(APP_HISTORY_BLOCK_COUNT, sizeof(struct app_history_block));
+        history_mutex = xSemaphoreCreateMutex();
+        if (!history_blocks || !history_mutex)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    memcpy(history_channels, channels, count * sizeof(*channels));
+    history_channel_count = count;
+    history_used = 0;
+    history_head = 0;
+    xSemaphoreGive(history_mutex);
+
+    ESP_LOGI(TAG, "history of %zu channels in %d blocks", count, APP_HISTORY_BLOCK_COUNT);
+    return ESP_OK;
+}
+
+esp_err_t app_history_add_channel(const struct app_history_channel *channel)
+{
+    if (channel == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!history_blocks)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    if (history_channel_count >= APP_HISTORY_MAX_CHANNELS)
+    {
+        xSemaphoreGive(history_mutex);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    history_channels[history_channel_count++] = *channel;
+    xSemaphoreGive(history_mutex);
+
+    ESP_LOGI(TAG, "history channel %s added", channel->name);
+    return ESP_OK;
+}
+
+void app_history_append(int64_t timestamp_ms, const float *values)
+{
+    if (!history_blocks || history_channel_count == 0)
+    {
+        return;
+    }
+
+    int64_t scaled[APP_HISTORY_MAX_CHANNELS];
+    for (size_t i = 0; i < history_channel_count; i++)
+    {
+        scaled[i] = isnan(values[i]) ? APP_HISTORY_MISSING : (int64_t)lroundf(values[i] * (float)history_channels[i].scale);
+    }
+
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+
+    // Blocks hold fixed number of channels, added channel starts new one
+    if (history_used == 0 || history_blocks[history_head].channels != history_channel_count)
+    {
+        app_history_start_block(timestamp_ms);
+    }
+
+    // Encode into temporary buffer first, state is restored if it does not fit
+    uint8_t buf[APP_HISTORY_SAMPLE_MAX];
+    struct app_history_state state = history_state;
+    size_t n = app_history_encode(buf, &state, timestamp_ms, scaled);
+
+    struct app_history_block *block = &history_blocks[history_head];
+    if (block->len + n > sizeof(block->data))
+    {
+        // Start new block, encoded against reset state
+        app_history_start_block(timestamp_ms);
+        block = &history_blocks[history_head];
+        state = history_state;
+        n = app_history_encode(buf, &state, timestamp_ms, scaled);
+    }
+
+    memcpy(&block->data[block->len], buf, n);
+    block->len += n;
+    block->count++;
+    history_state = state;
+
+    xSemaphoreGive(history_mutex);
+}
+
+static int64_t app_history_send_block(struct util_chunked *out, const struct app_history_block *block, size_t channel_count, int64_t since_ms)
+{
+    struct app_history_state state = {.ts = block->start_ms};
+    size_t pos = 0;
+
+    for (uint16_t s = 0; s < block->count; s++)
+    {
+        int64_t ts_dod = 0;
+        size_t n = varint_decode(&block->data[pos], block->len - pos, &ts_dod);
+        if (n == 0) break;
+        pos += n;
+
+        state.ts_delta += ts_dod;
+        state.ts += state.ts_delta;
+
+        for (size_t i = 0; i < block->channels; i++)
+        {
+            int64_t delta = 0;
+            n = varint_decode(&block->data[pos], block->len - pos, &delta);
+            if (n == 0) return since_ms;
+            pos += n;
+            state.values[i] += delta;
+        }
+
+        if (state.ts <= since_ms)
+        {
+            continue;
+        }
+        since_ms = state.ts;
+
+        util_chunked_append(out, "%lld", (long long)state.ts);
+        for (size_t i = 0; i < block->channels && i < channel_count; i++)
+        {
+            if (state.values[i] == APP_HISTORY_MISSING)
+            {
+                util_chunked_append(out, ",");
+            }
+            else if (history_channels[i].scale > 1)
+            {
+                util_chunked_append(out, ",%.2f", (double)state.values[i] / history_channels[i].scale);
+            }
+            else
+            {
+                util_chunked_append(out, ",%lld", (long long)state.values[i]);
+            }
+        }
+        for (size_t i = block->channels; i < channel_count; i++)
+        {
+            // Channel added later
+            util_chunked_append(out, ",");
+        }
+        util_chunked_append(out, "\n");
+    }
+    return since_ms;
+}
+
+esp_err_t app_history_http_handler(httpd_req_t *r)
+{
+    if (!history_blocks)
+    {
+        return httpd_resp_send_err(r, HTTPD_404_NOT_FOUND, "history not initialized");
+    }
+
+    // Parse query
+    int64_t since_ms = -1;
+    char query[40] = {};
+    char since_str[21] = {};
+    if (httpd_req_get_url_query_str(r, query, sizeof(query)) == ESP_OK
+        && httpd_query_key_value(query, "since", since_str, sizeof(since_str)) == ESP_OK)
+    {
+        since_ms = strtoll(since_str, NULL, 10);
+    }
+
+    httpd_resp_set_type(r, "text/csv");
+    struct util_chunked out;
+    util_chunked_init(&out, r);
+
+    // Header, with current time so clients can relate timestamps to their clock
+    // Channels are only added, so those in the header are in every block sent below, or are empty
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    size_t channel_count = history_channel_count;
+    xSemaphoreGive(history_mutex);
+    util_chunked_append(&out, "# now_ms=%lld\ntimestamp_ms", (long long)(esp_timer_get_time() / 1000));
+    for (size_t i = 0; i < channel_count; i++)
+    {
+        util_chunked_append(&out, ",%s", history_channels[i].name);
+    }
+    util_chunked_append(&out, "\n");
+
+    // Oldest to newest, each block is copied under the lock, so the control loop is never blocked by the network.
+    // Blocks can be overwritten meanwhile, so only samples newer than last sent one are sent.
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    size_t first = (history_head + APP_HISTORY_BLOCK_COUNT + 1 - history_used) % APP_HISTORY_BLOCK_COUNT;
+    size_t used = history_used;
+    xSemaphoreGive(history_mutex);
+
+    for (size_t b = 0; b < used && out.err == ESP_OK; b++)
+    {
+        xSemaphoreTake(history_mutex, portMAX_DELAY);
+        history_read_block = history_blocks[(first + b) % APP_HISTORY_BLOCK_COUNT];
+        xSemaphoreGive(history_mutex);
+
+        since_ms = app_history_send_block(&out, &history_read_block, channel_count, since_ms);
+    }
+
+    return util_chunked_finish(&out);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "app_zone.h"
+#include <ds18b20_group.h>
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_HISTORY_MAX_CHANNELS (DS18B20_GROUP_MAX_SIZE + 2 * APP_ZONE_MAX_COUNT) // Temperature per sensor, RPM and duty per zone
+
+struct app_history_channel
+{
+    const char *name; // Must stay valid for whole lifetime
+    int32_t scale;    // Stored value is real value multiplied by this
+};
+
+/**
+ * Initializes in-RAM history of given channels. Samples are compressed with delta-of-delta encoding of timestamps
+ * and delta encoding of values, into a ring of fixed size blocks, oldest block is overwritten once full.
+ *
+ * @param channels Channels description, array is copied
+ * @param count Number of channels
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if there is too many channels.
+ */
+esp_err_t app_history_init(const struct app_history_channel *channels, size_t count);
+
+/**
+ * Adds channel after the existing ones, it is in samples appended from now on, older samples have it empty.
+ *
+ * @param channel Channel description, it is copied
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if there is too many channels.
+ */
+esp_err_t app_history_add_channel(const struct app_history_channel *channel);
+
+/**
+ * Appends single sample, values are scaled and rounded according to channel config.
+ *
+ * @param timestamp_ms Sample time, must not decrease
+ * @param values Values of all channels, NAN when not known, such value is empty in CSV
+ */
+void app_history_append(int64_t timestamp_ms, const float *values);
+
+/**
+ * History handler, responds with CSV of samples newer than optional "since" query param, in ms since boot.
+ */
+esp_err_t app_history_http_handler(httpd_req_t *r);
+
+#ifdef __cplusplus
+}
+#endif
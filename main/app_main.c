@@ -1,5 +1,18 @@
+#include "app_config.h"
+#include "app_curve.h"
+#include "app_fusion.h"
+#include "app_history.h"
+#include "app_metrics.h"
+#include "app_params.h"
+#include "app_pid.h"
+#include "app_push.h"
+#include "app_report.h"
+#include "app_sensor_store.h"
 #include "app_status.h"
+#include "app_stream.h"
+#include "app_zone.h"
 #include "util/util_append.h"
+#include "util/util_triple.h"
 #include <app_rainmaker.h>
 #include <app_wifi.h>
 #include <double_reset.h>
@@ -10,10 +23,16 @@
 #include <esp_rmaker_core.h>
 #include <esp_rmaker_standard_params.h>
 #include <esp_rmaker_standard_types.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <math.h>
 #include <nvs_flash.h>
-#include <pc_fan_control.h>
-#include <pc_fan_rpm.h>
+#include <stdatomic.h>
 #include <status_led.h>
 #include <string.h>
 #include <wifi_reconnect.h>
@@ -23,18 +42,33 @@ static const char TAG[] = "app_main";
 #define APP_DEVICE_NAME CONFIG_APP_DEVICE_NAME
 #define APP_DEVICE_TYPE CONFIG_APP_DEVICE_TYPE
 #define APP_CONTROL_LOOP_INTERVAL CONFIG_APP_CONTROL_LOOP_INTERVAL
+#define APP_ADAPTIVE_RESOLUTION CONFIG_APP_ADAPTIVE_RESOLUTION
+#define APP_SECONDARY_SENSOR_PERIOD CONFIG_APP_SECONDARY_SENSOR_PERIOD
+#define APP_SENSOR_RESCAN_INTERVAL CONFIG_APP_SENSOR_RESCAN_INTERVAL
+#define APP_REPORT_TEMPERATURE_DEADBAND_MC CONFIG_APP_REPORT_TEMPERATURE_DEADBAND_MC
+#define APP_REPORT_RPM_DEADBAND CONFIG_APP_REPORT_RPM_DEADBAND
+#define APP_REPORT_DUTY_DEADBAND CONFIG_APP_REPORT_DUTY_DEADBAND
 #define HW_PWM_PIN CONFIG_HW_PWM_PIN
-#define HW_PWM_INVERTED CONFIG_HW_PWM_INVERTED
-#define HW_PWM_TIMER LEDC_TIMER_0
-#define HW_PWM_CHANNEL LEDC_CHANNEL_0
+#define HW_PWM_PIN_2 CONFIG_HW_PWM_PIN_2
+#define HW_PWM_PIN_3 CONFIG_HW_PWM_PIN_3
 #define HW_RPM_PIN CONFIG_HW_RPM_PIN
-#define HW_RPM_UNIT PCNT_UNIT_0
-#define HW_RPM_SAMPLES CONFIG_HW_RPM_SAMPLES
-#define HW_RPM_SAMPLING_INTERVAL CONFIG_HW_RPM_SAMPLING_INTERVAL
+#define HW_RPM_PIN_2 CONFIG_HW_RPM_PIN_2
+#define HW_RPM_PIN_3 CONFIG_HW_RPM_PIN_3
 #define HW_DS18B20_PIN CONFIG_HW_DS18B20_PIN
-#define SENSORS_RMT_CHANNEL_TX RMT_CHANNEL_0
-#define SENSORS_RMT_CHANNEL_RX RMT_CHANNEL_1
+#define HW_DS18B20_PIN_2 CONFIG_HW_DS18B20_PIN_2
+#define HW_DS18B20_PIN_3 CONFIG_HW_DS18B20_PIN_3
+#define SENSORS_BUS_COUNT 3
 #define SENSORS_NVS_NAME "sensors"
+#define SENSORS_TASK_STACK_SIZE 4096
+#define SENSORS_TASK_PRIORITY 5 // Above main task, so discovery is not starved by WiFi and RainMaker init
+#define SENSORS_TASK_CORE 0
+#define CONTROL_TASK_STACK_SIZE 4096
+#define CONTROL_TASK_PRIORITY 10                                // Above rest of the application, PWM update never waits
+#define CONTROL_TASK_CORE (portNUM_PROCESSORS - 1)              // APP CPU, away from WiFi and lwIP
+#define CONTROL_DEADLINE_MS (APP_CONTROL_LOOP_INTERVAL * 3 / 2) // Control runs without new readings after this
+#define BOOT_SENSORS_READY BIT0
+#define BOOT_FIRST_CONTROL BIT1
+#define BOOT_COMPLETE BIT2
 
 // Params
 #define APP_RMAKER_DEF_MAX_SPEED_NAME "Max Speed"
@@ -43,72 +77,252 @@ static const char TAG[] = "app_main";
 #define APP_RMAKER_DEF_LOW_TEMP_NAME "Low Temperature"
 #define APP_RMAKER_DEF_HIGH_TEMP_NAME "High Temperature"
 #define APP_RMAKER_DEF_PRIMARY_SENSOR_NAME "Primary Sensor"
+#define APP_RMAKER_DEF_CURVE_NAME "Fan Curve"
+#define APP_RMAKER_DEF_HYSTERESIS_NAME "Hysteresis"
+#define APP_RMAKER_DEF_SLEW_RATE_NAME "Slew Rate"
+#define APP_RMAKER_DEF_CONTROL_MODE_NAME "Control Mode"
+#define APP_RMAKER_DEF_SETPOINT_NAME "Setpoint"
+#define APP_RMAKER_DEF_PID_KP_NAME "PID Kp"
+#define APP_RMAKER_DEF_PID_KI_NAME "PID Ki"
+#define APP_RMAKER_DEF_PID_KD_NAME "PID Kd"
+#define APP_RMAKER_DEF_PID_KFF_NAME "PID Kff"
+#define APP_RMAKER_DEF_CALIBRATE_NAME "Calibrate"
 #define APP_RMAKER_DEF_SENSOR_NAME_NAME_F "Sensor %s Name"
 #define APP_RMAKER_DEF_SENSOR_OFFSET_NAME_F "Sensor %s Offset"
+#define APP_RMAKER_DEF_SENSOR_CURVE_NAME_F "Sensor %s Curve"
+#define APP_RMAKER_DEF_SOURCES_NAME "Sensors"
+#define APP_RMAKER_DEF_FUSION_NAME "Fusion"
+#define APP_RMAKER_DEF_RPM_NAME "RPM"
+#define APP_RMAKER_DEF_DUTY_NAME "Duty"
+#define APP_RMAKER_DEF_SENSOR_TEMPERATURE_NAME_F "Sensor %s Temperature"
 
-static esp_rmaker_param_t *max_speed_param = NULL;
-static esp_rmaker_param_t *low_speed_param = NULL;
-static esp_rmaker_param_t *high_speed_param = NULL;
-static esp_rmaker_param_t *low_temperature_param = NULL;
-static esp_rmaker_param_t *high_temperature_param = NULL;
-static esp_rmaker_param_t *primary_sensor_param = NULL;
+#define APP_RMAKER_ZONE_DEVICE_NAME_F "%s %u"
 
 // State
 static httpd_handle_t httpd = NULL;
-static owb_rmt_driver_info owb_driver = {};
+static EventGroupHandle_t boot_events = NULL;
+static const int sensors_bus_pins[SENSORS_BUS_COUNT] = {HW_DS18B20_PIN, HW_DS18B20_PIN_2, HW_DS18B20_PIN_3};
+static owb_rmt_driver_info owb_drivers[SENSORS_BUS_COUNT] = {};
 static ds18b20_group_handle_t sensors = NULL;
-static pc_fan_rpm_sampling_ptr rpm = NULL;
-static esp_timer_handle_t rpm_timer = NULL;
-static float fan_duty_percent = 0.9f;
+// Each zone uses its own LEDC channel (on shared timer) and PCNT unit
+static const struct app_zone_hw zones_hw[APP_ZONE_MAX_COUNT] = {
+    {.pwm_pin = HW_PWM_PIN, .pwm_channel = LEDC_CHANNEL_0, .rpm_pin = HW_RPM_PIN, .rpm_unit = PCNT_UNIT_0},
+    {.pwm_pin = HW_PWM_PIN_2, .pwm_channel = LEDC_CHANNEL_1, .rpm_pin = HW_RPM_PIN_2, .rpm_unit = PCNT_UNIT_1},
+    {.pwm_pin = HW_PWM_PIN_3, .pwm_channel = LEDC_CHANNEL_2, .rpm_pin = HW_RPM_PIN_3, .rpm_unit = PCNT_UNIT_2},
+};
+static const char *zones_rpm_history_names[APP_ZONE_MAX_COUNT] = {"rpm", "rpm2", "rpm3"};
+static const char *zones_duty_history_names[APP_ZONE_MAX_COUNT] = {"duty", "duty2", "duty3"};
+static struct app_zone zones[APP_ZONE_MAX_COUNT] = {};
+static size_t zone_count = 0;
+static char zones_device_name[APP_ZONE_MAX_COUNT][40] = {};
+static char zones_sources[APP_ZONE_MAX_COUNT][APP_ZONE_CURVE_LEN] = {}; // Empty means primary sensor only
+static esp_rmaker_param_t *zones_calibrate_param[APP_ZONE_MAX_COUNT] = {};
+static esp_rmaker_param_t *zones_primary_sensor_param[APP_ZONE_MAX_COUNT] = {};
+static size_t zones_rpm_report[APP_ZONE_MAX_COUNT] = {};  // See app_report_add()
+static size_t zones_duty_report[APP_ZONE_MAX_COUNT] = {}; // See app_report_add()
 static struct app_sensor_config
 {
+    uint64_t rom_code;
     char address[17];
-    char name[33];
+    char name[APP_SENSOR_STORE_NAME_LEN];
     float offset_c;
+    char curve_points[APP_ZONE_CURVE_LEN]; // Used by zones with APP_FUSION_CURVE_MAX, empty means zone curve
 
     char name_param_name[40];
     char offset_param_name[40];
+    char curve_param_name[40];
+    char temperature_param_name[40];
+    size_t temperature_report; // See app_report_add()
+    uint8_t bus;
+    bool present;
 } sensors_config[DS18B20_GROUP_MAX_SIZE] = {};
+static struct ds18b20_group_result sensor_results[DS18B20_GROUP_MAX_SIZE] = {};
 static float temperatures[DS18B20_GROUP_MAX_SIZE] = {};
+static float temperature_rates[DS18B20_GROUP_MAX_SIZE] = {};
+static int64_t temperature_times[DS18B20_GROUP_MAX_SIZE] = {};
 static size_t sensor_errors[DS18B20_GROUP_MAX_SIZE] = {};
+static struct app_fusion_sensor sensor_filters[DS18B20_GROUP_MAX_SIZE] = {};
+static bool temperatures_valid = false;
+static size_t known_sensor_count = 0;                               // Sensors with config and params, rest was just found by rescan
+static const char *sensor_addresses[DS18B20_GROUP_MAX_SIZE] = {};   // Valid values of primary sensor params
+static esp_rmaker_device_t *sensors_device = NULL;                  // Device holding sensor params
+static int64_t rescan_next = 0;                                     // esp_timer_get_time() of next rescan pass, 0 until first one
+static size_t history_sensor_count = 0;                             // Sensors known at boot, before zone channels
+static size_t history_added_count = 0;                              // Sensors found by rescan, after zone channels
+static struct app_sensors_layout                                    // Sensors found by rescan, applied by RainMaker work queue
+{
+    size_t count;
+    uint64_t rom_codes[DS18B20_GROUP_MAX_SIZE];
+    uint8_t buses[DS18B20_GROUP_MAX_SIZE];
+    bool present[DS18B20_GROUP_MAX_SIZE];
+} sensors_layout = {};
+static portMUX_TYPE sensors_layout_lock = portMUX_INITIALIZER_UNLOCKED;
+static atomic_bool sensors_layout_queued = false;
+static SemaphoreHandle_t sensors_config_lock = NULL; // Param handlers and sensor changes, sensor store included
+static struct app_sensors_snapshot                   // Sensor config used by sensors task, copied on every change
+{
+    size_t count;
+    char address[DS18B20_GROUP_MAX_SIZE][17];
+    char name[DS18B20_GROUP_MAX_SIZE][APP_SENSOR_STORE_NAME_LEN];
+    float offset_c[DS18B20_GROUP_MAX_SIZE];
+    bool source[DS18B20_GROUP_MAX_SIZE]; // Drives some zone
+} sensors_published = {}, sensors_snapshot = {};
+static portMUX_TYPE sensors_published_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool sensors_published_changed = false;
+
+// Tasks - sensors task owns the bus, control task owns the fans, main task does telemetry.
+// Each channel has single writer and single reader, so none of them ever waits for another.
+static struct app_sensors_frame // Sensors -> control
+{
+    bool ready; // At least one conversion finished
+    size_t count;
+    float filtered_c[DS18B20_GROUP_MAX_SIZE];
+    bool valid[DS18B20_GROUP_MAX_SIZE];
+} sensors_frames[3] = {};
+static struct app_sensors_stats // Sensors -> telemetry
+{
+    size_t count;
+    uint32_t conversion_ms;
+    struct app_metrics_sensor sensors[DS18B20_GROUP_MAX_SIZE];
+} sensors_stats[3] = {};
+static struct app_control_frame // Control -> telemetry
+{
+    size_t fan_count;
+    struct app_metrics_fan fans[APP_ZONE_MAX_COUNT];
+    bool calibrating[APP_ZONE_MAX_COUNT];
+    struct app_calibration calibration[APP_ZONE_MAX_COUNT]; // Stored once calibration finishes
+    enum app_health_status health[APP_ZONE_MAX_COUNT];
+} control_frames[3] = {};
+static struct util_triple sensors_channel = {};
+static struct util_triple stats_channel = {};
+static struct util_triple control_channel = {};
+static TaskHandle_t control_task_handle = NULL;
+static char device_name[APP_METRICS_HARDWARE_NAME_LEN] = APP_DEVICE_NAME;
 
 // Config
-static bool force_max_duty = false;
-static float low_duty_percent = 0.5f;
-static float high_duty_percent = 0.9f;
-static float low_temperature_threshold = 25.0f;
-static float high_temperature_threshold = 35.0f;
-static size_t primary_sensor_index = 0;
+static const char *control_mode_names[] = {"Curve", "PID", "RPM"};
+static const char *fusion_names[] = {"Max", "Mean", "Curve Max"};
 
 // Program
 static void app_devices_init(esp_rmaker_node_t *node);
-static void app_hw_init();
-static esp_err_t metrics_http_handler(httpd_req_t *r);
+static void app_zones_init();
+static void app_sensors_init();
+static void sensors_task(void *arg);
+static void control_task(void *arg);
+static size_t add_known_sensors();
+static void init_sensor_config(size_t i, const struct app_sensors_layout *layout);
+static void apply_sensor_record(size_t i);
+static void capture_sensors_layout(struct app_sensors_layout *layout);
+static void update_sensor_presence(const struct app_sensors_layout *layout);
+static void store_sensor_presence();
+static void migrate_sensor_config(size_t sensor_count);
+static void telemetry();
+
+static void publish_sensors_config()
+{
+    bool source[DS18B20_GROUP_MAX_SIZE] = {};
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        struct app_fusion_source sources[APP_FUSION_MAX_SOURCES];
+        size_t count = app_zone_get_sources(&zones[z], sources);
+        for (size_t k = 0; k < count; k++)
+        {
+            source[sources[k].index] = true;
+        }
+    }
+
+    // Sensors task takes the copy on its next cycle, sensors_config is changed by param handlers meanwhile
+    portENTER_CRITICAL(&sensors_published_lock);
+    sensors_published.count = known_sensor_count;
+    for (size_t i = 0; i < known_sensor_count; i++)
+    {
+        strlcpy(sensors_published.address[i], sensors_config[i].address, sizeof(sensors_published.address[i]));
+        strlcpy(sensors_published.name[i], sensors_config[i].name, sizeof(sensors_published.name[i]));
+        sensors_published.offset_c[i] = sensors_config[i].offset_c;
+    }
+    memcpy(sensors_published.source, source, sizeof(source));
+    sensors_published_changed = true;
+    portEXIT_CRITICAL(&sensors_published_lock);
+}
 
-static void set_fan_duty(float duty_percent)
+static void apply_sensors_config()
 {
-    // Log only on change
-    if (duty_percent != fan_duty_percent)
+    portENTER_CRITICAL(&sensors_published_lock);
+    bool changed = sensors_published_changed;
+    if (changed)
+    {
+        sensors_snapshot = sensors_published;
+        sensors_published_changed = false;
+    }
+    portEXIT_CRITICAL(&sensors_published_lock);
+    if (!changed)
     {
-        ESP_LOGI(TAG, "changing fan duty to %0.1f", fan_duty_percent * 100.0f);
+        return;
     }
 
-    // Invert if needed
-    float value = duty_percent;
-#if HW_PWM_INVERTED
-    value = 1.0f - value;
-#endif
+    // Zone source sensors drive the fans, so they are read every cycle, rest only every n-th
+    for (size_t i = 0; i < sensors->count; i++)
+    {
+        bool source = sensors_snapshot.source[i];
+        ds18b20_group_set_read_period(sensors, i, source ? 1 : APP_SECONDARY_SENSOR_PERIOD);
+        if (source)
+        {
+            ds18b20_group_request_read(sensors, i);
+        }
+    }
+}
 
-    // Change
-    esp_err_t err = pc_fan_control_set_duty(HW_PWM_CHANNEL, value);
-    if (err == ESP_OK)
+static esp_err_t update_zone_sources(struct app_zone *zone)
+{
+    size_t sensor_count = known_sensor_count;
+    if (sensor_count == 0)
     {
-        fan_duty_percent = duty_percent;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    struct app_fusion_source sources[APP_FUSION_MAX_SOURCES] = {};
+    size_t count = 0;
+    const char *sources_str = zones_sources[zone->index];
+    if (sources_str[0] != '\0')
+    {
+        const char *addresses[DS18B20_GROUP_MAX_SIZE] = {};
+        for (size_t i = 0; i < sensor_count; i++)
+        {
+            addresses[i] = sensors_config[i].address;
+        }
+        esp_err_t err = app_fusion_parse_sources(sources_str, addresses, sensor_count, sources, &count);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "invalid %s sensors '%s': %d %s", zone->name, sources_str, err, esp_err_to_name(err));
+            return err;
+        }
     }
     else
     {
-        ESP_LOGW(TAG, "failed to control fan: %d %s", err, esp_err_to_name(err));
+        // Legacy single sensor
+        sources[0] = (struct app_fusion_source){.index = zone->sensor_index < sensor_count ? zone->sensor_index : 0, .weight = 1.0f};
+        count = 1;
     }
+
+    const char *curves[APP_FUSION_MAX_SOURCES] = {};
+    for (size_t k = 0; k < count; k++)
+    {
+        curves[k] = sensors_config[sources[k].index].curve_points;
+    }
+    esp_err_t err = app_zone_set_sources(zone, sources, count, curves);
+    if (err == ESP_OK)
+    {
+        publish_sensors_config();
+    }
+    return err;
+}
+
+static int64_t sensor_max_age_us(size_t i)
+{
+    // Few missed reads are tolerated, a conversion takes up to a second. Period 0 means every cycle.
+    int64_t cycle_ms = APP_CONTROL_LOOP_INTERVAL > 1000 ? APP_CONTROL_LOOP_INTERVAL : 1000;
+    int64_t period = sensors->read_periods[i] > 0 ? sensors->read_periods[i] : 1;
+    return 3 * period * cycle_ms * 1000;
 }
 
 void setup()
@@ -121,6 +335,7 @@ void setup()
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(err);
+    ESP_ERROR_CHECK(app_config_init(SENSORS_NVS_NAME));
 
     // System services
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -131,9 +346,32 @@ void setup()
     bool reconfigure = false;
     ESP_ERROR_CHECK_WITHOUT_ABORT(double_reset_start(&reconfigure, DOUBLE_RESET_DEFAULT_TIMEOUT));
 
+    // Fans first, so they run at safe duty right away
+    app_zones_init();
+    app_metrics_boot_stage(APP_METRICS_BOOT_SAFE_DUTY);
+
+    // Control runs on its own core from now on, sensor discovery and first conversion in parallel with WiFi and RainMaker init
+    boot_events = xEventGroupCreate();
+    assert(boot_events);
+    sensors_config_lock = xSemaphoreCreateRecursiveMutex();
+    assert(sensors_config_lock);
+
+    // Sensors found by rescan are in stats before they have params, their reports must not go to other param
+    for (size_t i = 0; i < DS18B20_GROUP_MAX_SIZE; i++)
+    {
+        sensors_config[i].temperature_report = APP_REPORT_NONE;
+    }
+
+    util_triple_init(&sensors_channel, &sensors_frames[0], &sensors_frames[1], &sensors_frames[2]);
+    util_triple_init(&stats_channel, &sensors_stats[0], &sensors_stats[1], &sensors_stats[2]);
+    util_triple_init(&control_channel, &control_frames[0], &control_frames[1], &control_frames[2]);
+    BaseType_t created = xTaskCreatePinnedToCore(control_task, "control", CONTROL_TASK_STACK_SIZE, NULL, CONTROL_TASK_PRIORITY, &control_task_handle, CONTROL_TASK_CORE);
+    assert(created == pdPASS);
+    created = xTaskCreatePinnedToCore(sensors_task, "sensors", SENSORS_TASK_STACK_SIZE, NULL, SENSORS_TASK_PRIORITY, NULL, SENSORS_TASK_CORE);
+    assert(created == pdPASS);
+
     // Setup
     app_status_init();
-    app_hw_init();
 
     struct app_wifi_config wifi_cfg = {
         .security = WIFI_PROV_SECURITY_1,
@@ -142,6 +380,7 @@ void setup()
     ESP_ERROR_CHECK(app_wifi_init(&wifi_cfg));
     ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MAX_MODEM));
     ESP_ERROR_CHECK(wifi_reconnect_start());
+    app_metrics_boot_stage(APP_METRICS_BOOT_WIFI);
 
     // RainMaker
     char node_name[APP_RMAKER_NODE_NAME_LEN] = {};
@@ -150,77 +389,230 @@ void setup()
     esp_rmaker_node_t *node = NULL;
     ESP_ERROR_CHECK(app_rmaker_init(node_name, &node));
 
+    // Params are per sensor
+    xEventGroupWaitBits(boot_events, BOOT_SENSORS_READY, pdFALSE, pdTRUE, portMAX_DELAY);
     app_devices_init(node);
+    app_metrics_boot_stage(APP_METRICS_BOOT_RAINMAKER);
 
     // HTTP Server
     httpd_config_t httpd_config = HTTPD_DEFAULT_CONFIG();
+    httpd_config.close_fn = app_stream_close_fn;
     ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_start(&httpd, &httpd_config));
-    httpd_uri_t metrics_handler_uri = {.uri = "/metrics", .method = HTTP_GET, .handler = metrics_http_handler};
+    httpd_uri_t metrics_handler_uri = {.uri = "/metrics", .method = HTTP_GET, .handler = app_metrics_http_handler};
     ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_register_uri_handler(httpd, &metrics_handler_uri));
+    httpd_uri_t history_handler_uri = {.uri = "/history", .method = HTTP_GET, .handler = app_history_http_handler};
+    ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_register_uri_handler(httpd, &history_handler_uri));
+    httpd_uri_t stream_handler_uri = {.uri = "/stream", .method = HTTP_GET, .handler = app_stream_http_handler};
+    ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_register_uri_handler(httpd, &stream_handler_uri));
 
     // Start
     ESP_ERROR_CHECK(tcpip_adapter_set_hostname(TCPIP_ADAPTER_IF_STA, node_name)); // NOTE this isn't available before WiFi init
     ESP_ERROR_CHECK(esp_rmaker_start());
     ESP_ERROR_CHECK(app_wifi_start(reconfigure));
 
-    // Done
+    // Telemetry starts once there is something to report
+    xEventGroupWaitBits(boot_events, BOOT_FIRST_CONTROL, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    // Done, rescan can add params of new sensors from now on
+    xEventGroupSetBits(boot_events, BOOT_COMPLETE);
+    app_metrics_boot_stage(APP_METRICS_BOOT_READY);
     ESP_LOGI(TAG, "setup complete");
 }
 
-void app_hw_init()
+static void app_zones_init()
 {
-    // Fans
-    ESP_ERROR_CHECK_WITHOUT_ABORT(pc_fan_control_init(HW_PWM_PIN, HW_PWM_TIMER, HW_PWM_CHANNEL));
-    set_fan_duty(fan_duty_percent);
+    // Fan zones, unused ones have no PWM pin
+    for (size_t z = 0; z < APP_ZONE_MAX_COUNT; z++)
+    {
+        if (zones_hw[z].pwm_pin < 0)
+        {
+            continue;
+        }
+        ESP_ERROR_CHECK_WITHOUT_ABORT(app_zone_init(&zones[zone_count], zone_count, &zones_hw[z]));
+        app_zone_fallback(&zones[zone_count]);
+        zone_count++;
+    }
+}
 
-    struct pc_fan_rpm_config rpm_cfg = {
-        .pin = (gpio_num_t)HW_RPM_PIN,
-        .unit = (pcnt_unit_t)HW_RPM_UNIT,
-    };
-    pc_fan_rpm_handle_ptr rpm_handle = NULL;
-    ESP_ERROR_CHECK_WITHOUT_ABORT(pc_fan_rpm_create(&rpm_cfg, &rpm_handle));
-    ESP_ERROR_CHECK_WITHOUT_ABORT(pc_fan_rpm_sampling_create(HW_RPM_SAMPLES, rpm_handle, &rpm));
+static void app_sensors_init()
+{
+    // Temperature sensors, each bus uses its own pair of RMT channels (tx, rx)
+    for (size_t b = 0; b < SENSORS_BUS_COUNT; b++)
+    {
+        if (sensors_bus_pins[b] < 0)
+        {
+            continue;
+        }
 
-    // Start sampling timer
-    ESP_ERROR_CHECK_WITHOUT_ABORT(pc_fan_rpm_sampling_timer_create(rpm, &rpm_timer));
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_timer_start_periodic(rpm_timer, HW_RPM_SAMPLING_INTERVAL * 1000)); // ms to us
+        // Initialize OneWireBus
+        owb_rmt_initialize(&owb_drivers[b], sensors_bus_pins[b], (rmt_channel_t)(RMT_CHANNEL_0 + 2 * b), (rmt_channel_t)(RMT_CHANNEL_1 + 2 * b));
+        owb_use_crc(&owb_drivers[b].bus, true);
 
-    // Initialize OneWireBus
-    owb_rmt_initialize(&owb_driver, HW_DS18B20_PIN, SENSORS_RMT_CHANNEL_TX, SENSORS_RMT_CHANNEL_RX);
-    owb_use_crc(&owb_driver.bus, true);
+        if (!sensors)
+        {
+            ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_create(&owb_drivers[b].bus, &sensors));
+        }
+        else
+        {
+            ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_add_bus(sensors, &owb_drivers[b].bus));
+        }
+    }
 
-    // Temperature sensors
-    ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_create(&owb_driver.bus, &sensors));
     if (sensors)
     {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_find(sensors));
+        // Sensors connected last time are added without searching the bus, rescan later verifies them
+        esp_err_t store_err = app_sensor_store_load(SENSORS_NVS_NAME);
+        if (add_known_sensors() == 0)
+        {
+            ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_find(sensors));
+        }
         ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_use_crc(sensors, true));
         ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_set_resolution(sensors, DS18B20_RESOLUTION_12_BIT));
 
+        struct app_sensors_layout layout = {};
+        capture_sensors_layout(&layout);
+        for (size_t i = 0; i < layout.count; i++)
+        {
+            init_sensor_config(i, &layout);
+        }
+        if (store_err == ESP_ERR_NOT_FOUND)
+        {
+            migrate_sensor_config(sensors->count);
+        }
+
+        // Offsets apply to the first reading, curves to the first control decision
         for (size_t i = 0; i < sensors->count; i++)
         {
-            // Print address as string so we don't have to do that every time
-            snprintf(sensors_config[i].address, sizeof(sensors_config[i].address), "%llx", *(uint64_t *)sensors->devices[i].rom_code.bytes);
-            strcpy(sensors_config[i].name, sensors_config[i].address); // Default name is address
+            apply_sensor_record(i);
+        }
+        known_sensor_count = layout.count;
+        update_sensor_presence(&layout);
+        store_sensor_presence();
+
+        for (size_t z = 0; z < zone_count; z++)
+        {
+            update_zone_sources(&zones[z]);
+        }
+        publish_sensors_config();
+        apply_sensors_config();
+    }
+
+    // History of all temperatures, rpm and duty of each zone
+    struct app_history_channel history_channels[APP_HISTORY_MAX_CHANNELS] = {};
+    size_t history_channel_count = 0;
+    history_sensor_count = sensors ? sensors->count : 0;
+    for (size_t i = 0; i < history_sensor_count; i++)
+    {
+        history_channels[history_channel_count++] = (struct app_history_channel){.name = sensors_config[i].address, .scale = 100};
+    }
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        history_channels[history_channel_count++] = (struct app_history_channel){.name = zones_rpm_history_names[z], .scale = 1};
+        history_channels[history_channel_count++] = (struct app_history_channel){.name = zones_duty_history_names[z], .scale = 10};
+    }
+    ESP_ERROR_CHECK_WITHOUT_ABORT(app_history_init(history_channels, history_channel_count));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(app_push_init());
+}
+
+static esp_err_t name_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    if (zone->index == 0)
+    {
+        // Cache it, so it does not have to be read from NVS
+        strlcpy(device_name, val.val.s, sizeof(device_name));
+    }
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t max_speed_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    zone->force_max_duty = val.val.b;
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t low_speed_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    float value = (float)val.val.i / 100.0f;
+    if (value >= 0 && value <= 1)
+    {
+        float previous = zone->low_duty_percent;
+        zone->low_duty_percent = value;
+        esp_err_t err = app_zone_update_curve(zone);
+        if (err != ESP_OK)
+        {
+            zone->low_duty_percent = previous;
+            return err;
+        }
+        return esp_rmaker_param_update_and_report(param, val);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
 
-            snprintf(sensors_config[i].name_param_name, sizeof(sensors_config[i].name_param_name), APP_RMAKER_DEF_SENSOR_NAME_NAME_F, sensors_config[i].address);
-            snprintf(sensors_config[i].offset_param_name, sizeof(sensors_config[i].offset_param_name), APP_RMAKER_DEF_SENSOR_OFFSET_NAME_F, sensors_config[i].address);
+static esp_err_t high_speed_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    float value = (float)val.val.i / 100.0f;
+    if (value >= 0 && value <= 1)
+    {
+        float previous = zone->high_duty_percent;
+        zone->high_duty_percent = value;
+        esp_err_t err = app_zone_update_curve(zone);
+        if (err != ESP_OK)
+        {
+            zone->high_duty_percent = previous;
+            return err;
         }
+        return esp_rmaker_param_update_and_report(param, val);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t low_temperature_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    float previous = zone->low_temperature_threshold;
+    zone->low_temperature_threshold = val.val.f;
+    esp_err_t err = app_zone_update_curve(zone);
+    if (err != ESP_OK)
+    {
+        zone->low_temperature_threshold = previous;
+        return err;
+    }
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t high_temperature_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    float previous = zone->high_temperature_threshold;
+    zone->high_temperature_threshold = val.val.f;
+    esp_err_t err = app_zone_update_curve(zone);
+    if (err != ESP_OK)
+    {
+        zone->high_temperature_threshold = previous;
+        return err;
     }
+    return esp_rmaker_param_update_and_report(param, val);
 }
 
-static esp_err_t primary_sensor_param_handler(const esp_rmaker_param_t *param, const char *val)
+static esp_err_t primary_sensor_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
 {
+    struct app_zone *zone = (struct app_zone *)ctx;
+
     // Find primary sensor
-    if (sensors && sensors->count > 0)
+    if (known_sensor_count > 0)
     {
-        for (size_t i = 0; i < sensors->count; i++)
+        for (size_t i = 0; i < known_sensor_count; i++)
         {
-            if (strcmp(sensors_config[i].address, val) == 0)
+            if (strcmp(sensors_config[i].address, val.val.s) == 0)
             {
                 // Found
-                primary_sensor_index = i;
-                return esp_rmaker_param_update_and_report(param, esp_rmaker_str(val));
+                zone->sensor_index = i;
+                update_zone_sources(zone);
+                return esp_rmaker_param_update_and_report(param, val);
             }
         }
     }
@@ -229,352 +621,1212 @@ static esp_err_t primary_sensor_param_handler(const esp_rmaker_param_t *param, c
     return ESP_ERR_INVALID_STATE;
 }
 
-static esp_err_t sensor_name_param_handler(const esp_rmaker_param_t *param, const char *val, struct app_sensor_config *sensor_cfg)
+static esp_err_t curve_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
 {
-    assert(param);
-    assert(val);
-    assert(sensor_cfg);
+    struct app_zone *zone = (struct app_zone *)ctx;
+    char previous[sizeof(zone->curve_points)];
+    strlcpy(previous, zone->curve_points, sizeof(previous));
+    strlcpy(zone->curve_points, val.val.s, sizeof(zone->curve_points));
+    if (app_zone_update_curve(zone) != ESP_OK)
+    {
+        strlcpy(zone->curve_points, previous, sizeof(zone->curve_points));
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t control_mode_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    for (size_t i = 0; i < sizeof(control_mode_names) / sizeof(*control_mode_names); i++)
+    {
+        if (strcmp(val.val.s, control_mode_names[i]) == 0)
+        {
+            app_zone_set_mode(zone, (enum app_zone_mode)i);
+            return esp_rmaker_param_update_and_report(param, val);
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t setpoint_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    zone->pid_setpoint_c = val.val.f;
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t pid_kp_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    zone->pid_kp = val.val.f;
+    return esp_rmaker_param_update_and_report(param, val);
+}
 
-    // NOTE this will actually trim last two chars from address, which are always 28
-    char nvs_key[16] = {};
-    snprintf(nvs_key, sizeof(nvs_key), "n%.14s", sensor_cfg->address);
+static esp_err_t pid_ki_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    zone->pid_ki = val.val.f;
+    return esp_rmaker_param_update_and_report(param, val);
+}
 
-    char value[sizeof(sensor_cfg->name)] = {};
-    strlcpy(value, val, sizeof(value));
+static esp_err_t pid_kd_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    zone->pid_kd = val.val.f;
+    return esp_rmaker_param_update_and_report(param, val);
+}
 
-    // Custom NVS store
-    nvs_handle_t handle = 0;
-    esp_err_t err = nvs_open(SENSORS_NVS_NAME, NVS_READWRITE, &handle);
-    if (err != ESP_OK)
+static esp_err_t pid_kff_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    zone->pid_kff = val.val.f;
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t sources_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    char *sources = zones_sources[zone->index];
+    char previous[sizeof(zones_sources[0])];
+    strlcpy(previous, sources, sizeof(previous));
+    strlcpy(sources, val.val.s, sizeof(zones_sources[0]));
+    if (update_zone_sources(zone) != ESP_OK)
     {
-        ESP_LOGE(TAG, "nvs_open(%s) failed: %d %s", SENSORS_NVS_NAME, err, esp_err_to_name(err));
-        return err;
+        strlcpy(sources, previous, sizeof(zones_sources[0]));
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t fusion_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    for (size_t i = 0; i < sizeof(fusion_names) / sizeof(*fusion_names); i++)
+    {
+        if (strcmp(val.val.s, fusion_names[i]) == 0)
+        {
+            zone->fusion = (enum app_fusion_policy)i;
+            return esp_rmaker_param_update_and_report(param, val);
+        }
     }
-    err = nvs_set_str(handle, nvs_key, value);
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t calibrate_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_zone *zone = (struct app_zone *)ctx;
+    // Reported back as false once the sweep finishes, running sweep cannot be stopped
+    bool calibrating = val.val.b ? app_zone_calibrate(zone) : zone->sweep.active;
+    return esp_rmaker_param_update_and_report(param, esp_rmaker_bool(calibrating));
+}
+
+static esp_err_t hysteresis_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    app_zone_set_hysteresis((struct app_zone *)ctx, val.val.f);
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static esp_err_t slew_rate_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    app_zone_set_slew_rate((struct app_zone *)ctx, (float)val.val.i / 100.0f);
+    return esp_rmaker_param_update_and_report(param, val);
+}
+
+static void sensor_record(const struct app_sensor_config *sensor_cfg, struct app_sensor_record *record)
+{
+    size_t i = (size_t)(sensor_cfg - sensors_config);
+    *record = (struct app_sensor_record){
+        .rom_code = sensor_cfg->rom_code,
+        .offset_c = sensor_cfg->offset_c,
+        .bus = sensor_cfg->bus,
+        .slot = sensor_cfg->present ? (uint8_t)(i + 1) : 0,
+    };
+    strlcpy(record->name, sensor_cfg->name, sizeof(record->name));
+    strlcpy(record->curve_points, sensor_cfg->curve_points, sizeof(record->curve_points));
+}
+
+static esp_err_t store_sensor_record(const struct app_sensor_record *record)
+{
+    // Written to NVS later, together with other changes
+    esp_err_t err = app_sensor_store_put(record);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "nvs_set_str(%s) failed: %d %s", nvs_key, err, esp_err_to_name(err));
-        return err;
+        ESP_LOGE(TAG, "failed to store sensor %llx: %d %s", record->rom_code, err, esp_err_to_name(err));
     }
-    err = nvs_commit(handle);
+    return err;
+}
+
+static esp_err_t sensor_name_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
+{
+    struct app_sensor_config *sensor_cfg = (struct app_sensor_config *)ctx;
+    assert(param);
+    assert(val.val.s);
+    assert(sensor_cfg);
+
+    struct app_sensor_record record = {};
+    sensor_record(sensor_cfg, &record);
+    strlcpy(record.name, val.val.s, sizeof(record.name));
+    esp_err_t err = store_sensor_record(&record);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "nvs_commit(%s): %d %s", SENSORS_NVS_NAME, err, esp_err_to_name(err));
         return err;
     }
-    nvs_close(handle);
 
     // Store state
-    strlcpy(sensor_cfg->name, value, sizeof(sensor_cfg->name));
+    strlcpy(sensor_cfg->name, record.name, sizeof(sensor_cfg->name));
+    publish_sensors_config();
 
     // Report
     return esp_rmaker_param_update_and_report(param, esp_rmaker_str(sensor_cfg->name));
 }
 
-static esp_err_t sensor_offset_param_handler(const esp_rmaker_param_t *param, float val, struct app_sensor_config *sensor_cfg)
+static esp_err_t sensor_offset_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
 {
+    struct app_sensor_config *sensor_cfg = (struct app_sensor_config *)ctx;
     assert(param);
     assert(sensor_cfg);
 
-    // NOTE this will actually trim last two chars from address, which are always 28
-    char nvs_key[16] = {};
-    snprintf(nvs_key, sizeof(nvs_key), "o%.14s", sensor_cfg->address);
-
-    // Custom NVS store
-    nvs_handle_t handle = 0;
-    esp_err_t err = nvs_open(SENSORS_NVS_NAME, NVS_READWRITE, &handle);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "nvs_open(%s) failed: %d %s", SENSORS_NVS_NAME, err, esp_err_to_name(err));
-        return err;
-    }
-    // float is not support it directly, so store it as multiplication of desired precision
-    int32_t val_int = (int32_t)(val * 1000.0f);
-    err = nvs_set_i32(handle, nvs_key, val_int);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "nvs_set_i32(%s) failed: %d %s", nvs_key, err, esp_err_to_name(err));
-        return err;
-    }
-    err = nvs_commit(handle);
+    struct app_sensor_record record = {};
+    sensor_record(sensor_cfg, &record);
+    record.offset_c = val.val.f;
+    esp_err_t err = store_sensor_record(&record);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "nvs_commit(%s): %d %s", SENSORS_NVS_NAME, err, esp_err_to_name(err));
         return err;
     }
-    nvs_close(handle);
 
     // Store state
-    sensor_cfg->offset_c = (float)val_int / 1000.0f;
+    sensor_cfg->offset_c = record.offset_c;
+    publish_sensors_config();
 
     // Report
     return esp_rmaker_param_update_and_report(param, esp_rmaker_float(sensor_cfg->offset_c));
 }
 
-static esp_err_t device_write_cb(__unused const esp_rmaker_device_t *device, const esp_rmaker_param_t *param,
-                                 const esp_rmaker_param_val_t val, __unused void *private_data,
-                                 __unused esp_rmaker_write_ctx_t *ctx)
+static esp_err_t sensor_curve_param_handler(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx)
 {
-    char *name = esp_rmaker_param_get_name(param);
-    if (strcmp(name, APP_RMAKER_DEF_MAX_SPEED_NAME) == 0)
-    {
-        force_max_duty = val.val.b;
-        return esp_rmaker_param_update_and_report(param, val);
-    }
-    if (strcmp(name, APP_RMAKER_DEF_LOW_SPEED_NAME) == 0)
+    struct app_sensor_config *sensor_cfg = (struct app_sensor_config *)ctx;
+    assert(param);
+    assert(val.val.s);
+    assert(sensor_cfg);
+
+    // Validate before storing
+    struct app_curve_point points[APP_CURVE_MAX_POINTS] = {};
+    size_t count = 0;
+    if (val.val.s[0] != '\0' && app_curve_parse(val.val.s, points, &count) != ESP_OK)
     {
-        float value = (float)val.val.i / 100.0f;
-        if (value >= 0 && value <= 1)
-        {
-            low_duty_percent = value;
-            return esp_rmaker_param_update_and_report(param, val);
-        }
         return ESP_ERR_INVALID_ARG;
     }
-    if (strcmp(name, APP_RMAKER_DEF_HIGH_SPEED_NAME) == 0)
+
+    struct app_sensor_record record = {};
+    sensor_record(sensor_cfg, &record);
+    strlcpy(record.curve_points, val.val.s, sizeof(record.curve_points));
+    esp_err_t err = store_sensor_record(&record);
+    if (err != ESP_OK)
     {
-        float value = (float)val.val.i / 100.0f;
-        if (value >= 0 && value <= 1)
-        {
-            high_duty_percent = value;
-            return esp_rmaker_param_update_and_report(param, val);
-        }
-        return ESP_ERR_INVALID_ARG;
+        return err;
     }
-    if (strcmp(name, APP_RMAKER_DEF_LOW_TEMP_NAME) == 0)
+
+    // Store state and rebuild curves of zones using it
+    strlcpy(sensor_cfg->curve_points, record.curve_points, sizeof(sensor_cfg->curve_points));
+    for (size_t z = 0; z < zone_count; z++)
     {
-        low_temperature_threshold = val.val.f;
-        return esp_rmaker_param_update_and_report(param, val);
+        update_zone_sources(&zones[z]);
     }
-    if (strcmp(name, APP_RMAKER_DEF_HIGH_TEMP_NAME) == 0)
+
+    // Report
+    return esp_rmaker_param_update_and_report(param, esp_rmaker_str(sensor_cfg->curve_points));
+}
+
+static esp_err_t device_write_cb(__unused const esp_rmaker_device_t *device, const esp_rmaker_param_t *param,
+                                 const esp_rmaker_param_val_t val, __unused void *private_data,
+                                 __unused esp_rmaker_write_ctx_t *ctx)
+{
+    // Every writable param has its handler registered before it is added, so stored values are applied on init.
+    // Writes come from cloud and local control tasks, so they are serialized with sensor changes.
+    xSemaphoreTakeRecursive(sensors_config_lock, portMAX_DELAY);
+    esp_err_t err = app_params_dispatch(param, val);
+    xSemaphoreGiveRecursive(sensors_config_lock);
+    if (err == ESP_ERR_NOT_FOUND)
     {
-        high_temperature_threshold = val.val.f;
-        return esp_rmaker_param_update_and_report(param, val);
+        ESP_LOGE(TAG, "no handler for param %s", esp_rmaker_param_get_name(param));
     }
-    if (strcmp(name, APP_RMAKER_DEF_PRIMARY_SENSOR_NAME) == 0)
+    return err;
+}
+
+static esp_rmaker_device_t *app_zone_device_init(esp_rmaker_node_t *node, struct app_zone *zone, const char **addresses, size_t sensor_count)
+{
+    // Prepare device, first zone keeps plain name, so existing setups are not affected
+    char *zone_device_name = zones_device_name[zone->index];
+    if (zone->index == 0)
     {
-        return primary_sensor_param_handler(param, val.val.s);
+        strlcpy(zone_device_name, APP_DEVICE_NAME, sizeof(zones_device_name[0]));
     }
-
-    if (sensors)
+    else
     {
-        for (size_t i = 0; i < sensors->count; i++)
-        {
-            if (strcmp(name, sensors_config[i].name_param_name) == 0)
-            {
-                return sensor_name_param_handler(param, val.val.s, &sensors_config[i]);
-            }
-            if (strcmp(name, sensors_config[i].offset_param_name) == 0)
-            {
-                return sensor_offset_param_handler(param, val.val.f, &sensors_config[i]);
-            }
-        }
+        snprintf(zone_device_name, sizeof(zones_device_name[0]), APP_RMAKER_ZONE_DEVICE_NAME_F, APP_DEVICE_NAME, (unsigned int)(zone->index + 1));
     }
-    return ESP_OK;
-}
 
-static void app_devices_init(esp_rmaker_node_t *node)
-{
-    // Prepare device
-    esp_rmaker_device_t *device = esp_rmaker_device_create(APP_DEVICE_NAME, APP_DEVICE_TYPE, NULL);
+    esp_rmaker_device_t *device = esp_rmaker_device_create(zone_device_name, APP_DEVICE_TYPE, zone);
     assert(device);
 
     ESP_ERROR_CHECK(esp_rmaker_node_add_device(node, device));
     ESP_ERROR_CHECK(esp_rmaker_device_add_cb(device, device_write_cb, NULL));
-    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, esp_rmaker_name_param_create(ESP_RMAKER_DEF_NAME_PARAM, APP_DEVICE_NAME)));
+
+    esp_rmaker_param_t *name_param = esp_rmaker_name_param_create(ESP_RMAKER_DEF_NAME_PARAM, zone->index == 0 ? device_name : zone_device_name);
+    ESP_ERROR_CHECK(app_params_register(name_param, name_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, name_param));
 
     // Register buttons, sensors, etc
-    max_speed_param = esp_rmaker_param_create(APP_RMAKER_DEF_MAX_SPEED_NAME, ESP_RMAKER_PARAM_SPEED, esp_rmaker_bool(false), PROP_FLAG_READ | PROP_FLAG_WRITE);
+    esp_rmaker_param_t *max_speed_param = esp_rmaker_param_create(APP_RMAKER_DEF_MAX_SPEED_NAME, ESP_RMAKER_PARAM_SPEED, esp_rmaker_bool(false), PROP_FLAG_READ | PROP_FLAG_WRITE);
     ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(max_speed_param, ESP_RMAKER_UI_TOGGLE));
+    ESP_ERROR_CHECK(app_params_register(max_speed_param, max_speed_param_handler, zone));
     ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, max_speed_param));
 
-    low_speed_param = esp_rmaker_param_create(APP_RMAKER_DEF_LOW_SPEED_NAME, ESP_RMAKER_PARAM_SPEED, esp_rmaker_int((int)(low_duty_percent * 100.0f)), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    esp_rmaker_param_t *low_speed_param = esp_rmaker_param_create(APP_RMAKER_DEF_LOW_SPEED_NAME, ESP_RMAKER_PARAM_SPEED, esp_rmaker_int((int)(zone->low_duty_percent * 100.0f)), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
     ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(low_speed_param, ESP_RMAKER_UI_TEXT));
     ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(low_speed_param, esp_rmaker_int(0), esp_rmaker_int(100), esp_rmaker_int(1)));
+    ESP_ERROR_CHECK(app_params_register(low_speed_param, low_speed_param_handler, zone));
     ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, low_speed_param));
 
-    high_speed_param = esp_rmaker_param_create(APP_RMAKER_DEF_HIGH_SPEED_NAME, ESP_RMAKER_PARAM_SPEED, esp_rmaker_int((int)(high_duty_percent * 100.0f)), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    esp_rmaker_param_t *high_speed_param = esp_rmaker_param_create(APP_RMAKER_DEF_HIGH_SPEED_NAME, ESP_RMAKER_PARAM_SPEED, esp_rmaker_int((int)(zone->high_duty_percent * 100.0f)), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
     ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(high_speed_param, ESP_RMAKER_UI_TEXT));
     ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(high_speed_param, esp_rmaker_int(0), esp_rmaker_int(100), esp_rmaker_int(1)));
+    ESP_ERROR_CHECK(app_params_register(high_speed_param, high_speed_param_handler, zone));
     ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, high_speed_param));
 
-    low_temperature_param = esp_rmaker_param_create(APP_RMAKER_DEF_LOW_TEMP_NAME, ESP_RMAKER_PARAM_TEMPERATURE, esp_rmaker_float(low_temperature_threshold), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    esp_rmaker_param_t *low_temperature_param = esp_rmaker_param_create(APP_RMAKER_DEF_LOW_TEMP_NAME, ESP_RMAKER_PARAM_TEMPERATURE, esp_rmaker_float(zone->low_temperature_threshold), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
     ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(low_temperature_param, ESP_RMAKER_UI_TEXT));
     ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(low_temperature_param, esp_rmaker_float(0), esp_rmaker_float(50), esp_rmaker_float(0.5f)));
+    ESP_ERROR_CHECK(app_params_register(low_temperature_param, low_temperature_param_handler, zone));
     ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, low_temperature_param));
 
-    high_temperature_param = esp_rmaker_param_create(APP_RMAKER_DEF_HIGH_TEMP_NAME, ESP_RMAKER_PARAM_TEMPERATURE, esp_rmaker_float(high_temperature_threshold), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    esp_rmaker_param_t *high_temperature_param = esp_rmaker_param_create(APP_RMAKER_DEF_HIGH_TEMP_NAME, ESP_RMAKER_PARAM_TEMPERATURE, esp_rmaker_float(zone->high_temperature_threshold), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
     ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(high_temperature_param, ESP_RMAKER_UI_TEXT));
     ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(high_temperature_param, esp_rmaker_float(0), esp_rmaker_float(50), esp_rmaker_float(0.5f)));
+    ESP_ERROR_CHECK(app_params_register(high_temperature_param, high_temperature_param_handler, zone));
     ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, high_temperature_param));
 
-    size_t sensor_count = sensors ? sensors->count : 0;
+    esp_rmaker_param_t *curve_param = esp_rmaker_param_create(APP_RMAKER_DEF_CURVE_NAME, NULL, esp_rmaker_str(zone->curve_points), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(curve_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(app_params_register(curve_param, curve_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, curve_param));
+
+    esp_rmaker_param_t *hysteresis_param = esp_rmaker_param_create(APP_RMAKER_DEF_HYSTERESIS_NAME, ESP_RMAKER_PARAM_TEMPERATURE, esp_rmaker_float(zone->curve_hysteresis_c), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(hysteresis_param, ESP_RMAKER_UI_SLIDER));
+    ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(hysteresis_param, esp_rmaker_float(0), esp_rmaker_float(2), esp_rmaker_float(0.1f)));
+    ESP_ERROR_CHECK(app_params_register(hysteresis_param, hysteresis_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, hysteresis_param));
+
+    esp_rmaker_param_t *slew_rate_param = esp_rmaker_param_create(APP_RMAKER_DEF_SLEW_RATE_NAME, NULL, esp_rmaker_int((int)(zone->curve_slew_rate * 100.0f)), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(slew_rate_param, ESP_RMAKER_UI_SLIDER));
+    ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(slew_rate_param, esp_rmaker_int(0), esp_rmaker_int(100), esp_rmaker_int(1)));
+    ESP_ERROR_CHECK(app_params_register(slew_rate_param, slew_rate_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, slew_rate_param));
+
+    esp_rmaker_param_t *control_mode_param = esp_rmaker_param_create(APP_RMAKER_DEF_CONTROL_MODE_NAME, NULL, esp_rmaker_str(control_mode_names[zone->mode]), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(control_mode_param, ESP_RMAKER_UI_DROPDOWN));
+    ESP_ERROR_CHECK(esp_rmaker_param_add_valid_str_list(control_mode_param, control_mode_names, sizeof(control_mode_names) / sizeof(*control_mode_names)));
+    ESP_ERROR_CHECK(app_params_register(control_mode_param, control_mode_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, control_mode_param));
+
+    esp_rmaker_param_t *setpoint_param = esp_rmaker_param_create(APP_RMAKER_DEF_SETPOINT_NAME, ESP_RMAKER_PARAM_TEMPERATURE, esp_rmaker_float(zone->pid_setpoint_c), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(setpoint_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(setpoint_param, esp_rmaker_float(0), esp_rmaker_float(50), esp_rmaker_float(0.5f)));
+    ESP_ERROR_CHECK(app_params_register(setpoint_param, setpoint_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, setpoint_param));
+
+    esp_rmaker_param_t *pid_kp_param = esp_rmaker_param_create(APP_RMAKER_DEF_PID_KP_NAME, NULL, esp_rmaker_float(zone->pid_kp), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(pid_kp_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(app_params_register(pid_kp_param, pid_kp_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, pid_kp_param));
+
+    esp_rmaker_param_t *pid_ki_param = esp_rmaker_param_create(APP_RMAKER_DEF_PID_KI_NAME, NULL, esp_rmaker_float(zone->pid_ki), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(pid_ki_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(app_params_register(pid_ki_param, pid_ki_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, pid_ki_param));
+
+    esp_rmaker_param_t *pid_kd_param = esp_rmaker_param_create(APP_RMAKER_DEF_PID_KD_NAME, NULL, esp_rmaker_float(zone->pid_kd), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(pid_kd_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(app_params_register(pid_kd_param, pid_kd_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, pid_kd_param));
+
+    esp_rmaker_param_t *pid_kff_param = esp_rmaker_param_create(APP_RMAKER_DEF_PID_KFF_NAME, NULL, esp_rmaker_float(zone->pid_kff), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(pid_kff_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(app_params_register(pid_kff_param, pid_kff_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, pid_kff_param));
+
+    zones_calibrate_param[zone->index] = esp_rmaker_param_create(APP_RMAKER_DEF_CALIBRATE_NAME, NULL, esp_rmaker_bool(false), PROP_FLAG_READ | PROP_FLAG_WRITE);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(zones_calibrate_param[zone->index], ESP_RMAKER_UI_TOGGLE));
+    ESP_ERROR_CHECK(app_params_register(zones_calibrate_param[zone->index], calibrate_param_handler, zone));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, zones_calibrate_param[zone->index]));
+
+    // Measured values, read-only
+    esp_rmaker_param_t *rpm_param = esp_rmaker_param_create(APP_RMAKER_DEF_RPM_NAME, NULL, esp_rmaker_int(0), PROP_FLAG_READ);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(rpm_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, rpm_param));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(app_report_add(rpm_param, true, APP_REPORT_RPM_DEADBAND, &zones_rpm_report[zone->index]));
+
+    esp_rmaker_param_t *duty_param = esp_rmaker_param_create(APP_RMAKER_DEF_DUTY_NAME, NULL, esp_rmaker_int((int)(zone->duty_percent * 100.0f)), PROP_FLAG_READ);
+    ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(duty_param, ESP_RMAKER_UI_TEXT));
+    ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, duty_param));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(app_report_add(duty_param, true, APP_REPORT_DUTY_DEADBAND, &zones_duty_report[zone->index]));
+
     if (sensor_count > 0)
     {
-        // NOTE this is never deallocated, since RainMaker is using it during its lifetime and it never changes anyway
-        const char **sensor_addresses = calloc(sensor_count, sizeof(const char *));
-        // Reference config values
-        for (size_t i = 0; i < sensor_count; i++)
-        {
-            sensor_addresses[i] = sensors_config[i].address;
-        }
-
-        primary_sensor_param = esp_rmaker_param_create(APP_RMAKER_DEF_PRIMARY_SENSOR_NAME, NULL, esp_rmaker_str(sensor_addresses[0]), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+        // Source sensor of the zone
+        esp_rmaker_param_t *primary_sensor_param = esp_rmaker_param_create(APP_RMAKER_DEF_PRIMARY_SENSOR_NAME, NULL, esp_rmaker_str(addresses[0]), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
         ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(primary_sensor_param, ESP_RMAKER_UI_DROPDOWN));
-        ESP_ERROR_CHECK(esp_rmaker_param_add_valid_str_list(primary_sensor_param, sensor_addresses, sensor_count));
+        ESP_ERROR_CHECK(esp_rmaker_param_add_valid_str_list(primary_sensor_param, addresses, sensor_count));
+        ESP_ERROR_CHECK(app_params_register(primary_sensor_param, primary_sensor_param_handler, zone));
         ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, primary_sensor_param));
+        zones_primary_sensor_param[zone->index] = primary_sensor_param;
+
+        esp_rmaker_param_t *sources_param = esp_rmaker_param_create(APP_RMAKER_DEF_SOURCES_NAME, NULL, esp_rmaker_str(zones_sources[zone->index]), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+        ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(sources_param, ESP_RMAKER_UI_TEXT));
+        ESP_ERROR_CHECK(app_params_register(sources_param, sources_param_handler, zone));
+        ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, sources_param));
+
+        esp_rmaker_param_t *fusion_param = esp_rmaker_param_create(APP_RMAKER_DEF_FUSION_NAME, NULL, esp_rmaker_str(fusion_names[zone->fusion]), PROP_FLAG_READ | PROP_FLAG_WRITE | PROP_FLAG_PERSIST);
+        ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(fusion_param, ESP_RMAKER_UI_DROPDOWN));
+        ESP_ERROR_CHECK(esp_rmaker_param_add_valid_str_list(fusion_param, fusion_names, sizeof(fusion_names) / sizeof(*fusion_names)));
+        ESP_ERROR_CHECK(app_params_register(fusion_param, fusion_param_handler, zone));
+        ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, fusion_param));
+    }
+
+    return device;
+}
 
-        // Custom NVS store
-        // NOTE we ignore errors here, because it might not be initialized yet on first boot
-        nvs_handle_t handle = 0;
-        ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_open(SENSORS_NVS_NAME, NVS_READONLY, &handle));
+static void migrate_sensor_config(size_t sensor_count)
+{
+    // Older firmware stored each value under its own key, derived from the address
+    nvs_handle_t handle = 0;
+    if (nvs_open(SENSORS_NVS_NAME, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
 
-        // Sensors config
-        for (size_t i = 0; i < sensor_count; i++)
+    bool migrated = false;
+    for (size_t i = 0; i < sensor_count; i++)
+    {
+        // NOTE this will actually trim last two chars from address, which are always 28
+        char nvs_name_key[16] = {};
+        char nvs_offset_key[16] = {};
+        char nvs_curve_key[16] = {};
+        snprintf(nvs_name_key, sizeof(nvs_name_key), "n%.14s", sensors_config[i].address);
+        snprintf(nvs_offset_key, sizeof(nvs_offset_key), "o%.14s", sensors_config[i].address);
+        snprintf(nvs_curve_key, sizeof(nvs_curve_key), "c%.14s", sensors_config[i].address);
+
+        struct app_sensor_record record = {};
+        sensor_record(&sensors_config[i], &record);
+
+        size_t nvs_name_len = sizeof(record.name);
+        bool found = nvs_get_str(handle, nvs_name_key, record.name, &nvs_name_len) == ESP_OK;
+
+        int32_t offset_int = 0;
+        if (nvs_get_i32(handle, nvs_offset_key, &offset_int) == ESP_OK)
         {
-            // NOTE this will actually trim last two chars from address, which are always 28
-            char nvs_name_key[16] = {};
-            char nvs_offset_key[16] = {};
-            snprintf(nvs_name_key, sizeof(nvs_name_key), "n%.14s", sensors_config[i].address);
-            snprintf(nvs_offset_key, sizeof(nvs_offset_key), "o%.14s", sensors_config[i].address);
+            record.offset_c = (float)offset_int / 1000.0f;
+            found = true;
+        }
 
-            size_t nvs_name_len = sizeof(sensors_config[i].name);
-            nvs_get_str(handle, nvs_name_key, sensors_config[i].name, &nvs_name_len);
+        size_t nvs_curve_len = sizeof(record.curve_points);
+        found |= nvs_get_str(handle, nvs_curve_key, record.curve_points, &nvs_curve_len) == ESP_OK;
 
-            int32_t offset_int = (int32_t)(sensors_config[i].offset_c * 1000.0f);
-            nvs_get_i32(handle, nvs_offset_key, &offset_int);
-            sensors_config[i].offset_c = (float)offset_int / 1000.0f;
+        if (found && store_sensor_record(&record) == ESP_OK)
+        {
+            migrated = true;
+        }
+    }
 
-            esp_rmaker_param_t *sensor_name_param = esp_rmaker_param_create(sensors_config[i].name_param_name, NULL, esp_rmaker_str(sensors_config[i].name), PROP_FLAG_READ | PROP_FLAG_WRITE);
-            ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(sensor_name_param, ESP_RMAKER_UI_TEXT));
-            ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, sensor_name_param));
+    // Old keys go away only once the blob is safely written
+    if (migrated && app_config_flush() == ESP_OK)
+    {
+        for (size_t i = 0; i < sensor_count; i++)
+        {
+            char nvs_key[16] = {};
+            snprintf(nvs_key, sizeof(nvs_key), "n%.14s", sensors_config[i].address);
+            nvs_erase_key(handle, nvs_key);
+            snprintf(nvs_key, sizeof(nvs_key), "o%.14s", sensors_config[i].address);
+            nvs_erase_key(handle, nvs_key);
+            snprintf(nvs_key, sizeof(nvs_key), "c%.14s", sensors_config[i].address);
+            nvs_erase_key(handle, nvs_key);
+        }
+        ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_commit(handle));
+        ESP_LOGI(TAG, "sensor config migrated");
+    }
+    nvs_close(handle);
+}
 
-            esp_rmaker_param_t *sensor_offset_param = esp_rmaker_param_create(sensors_config[i].offset_param_name, NULL, esp_rmaker_float(sensors_config[i].offset_c), PROP_FLAG_READ | PROP_FLAG_WRITE);
-            ESP_ERROR_CHECK(esp_rmaker_param_add_ui_type(sensor_offset_param, ESP_RMAKER_UI_SLIDER));
-            ESP_ERROR_CHECK(esp_rmaker_param_add_bounds(sensor_offset_param, esp_rmaker_float(-1.0f), esp_rmaker_float(1.0f), esp_rmaker_float(0.05f)));
-            ESP_ERROR_CHECK(esp_rmaker_device_add_param(device, sensor_offset_param));
+static size_t add_known_sensors()
+{
+    // In order of their slots, so indexes match previous run
+    size_t record_count = 0;
+    const struct app_sensor_record *records = app_sensor_store_records(&record_count);
+    const struct app_sensor_record *known[DS18B20_GROUP_MAX_SIZE] = {};
+    for (size_t r = 0; r < record_count; r++)
+    {
+        size_t slot = records[r].slot;
+        if (slot > 0 && slot <= DS18B20_GROUP_MAX_SIZE && !known[slot - 1])
+        {
+            known[slot - 1] = &records[r];
         }
+    }
 
-        // Close NVS
-        nvs_close(handle);
+    size_t added = 0;
+    for (size_t k = 0; k < DS18B20_GROUP_MAX_SIZE; k++)
+    {
+        if (!known[k])
+        {
+            continue;
+        }
+
+        OneWireBus_ROMCode rom_code = {};
+        memcpy(rom_code.bytes, &known[k]->rom_code, sizeof(rom_code.bytes));
+        esp_err_t err = ds18b20_group_add_device(sensors, known[k]->bus, &rom_code);
+        if (err == ESP_OK)
+        {
+            added++;
+        }
+        else
+        {
+            ESP_LOGW(TAG, "failed to add known sensor %llx: %d %s", known[k]->rom_code, err, esp_err_to_name(err));
+        }
     }
+    return added;
 }
 
-static esp_err_t metrics_http_handler(httpd_req_t *r)
+static void capture_sensors_layout(struct app_sensors_layout *layout)
 {
-    // Read device name from NVS, since rainmaker provides absolutely no means to get it directly
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open(APP_DEVICE_NAME, NVS_READONLY, &handle);
+    // Owned by the sensors task, rest of the application sees only copies
+    layout->count = sensors->count;
+    for (size_t i = 0; i < sensors->count; i++)
+    {
+        layout->rom_codes[i] = *(uint64_t *)sensors->devices[i].rom_code.bytes;
+        layout->buses[i] = sensors->device_buses[i];
+        layout->present[i] = sensors->present[i];
+    }
+}
+
+static void init_sensor_config(size_t i, const struct app_sensors_layout *layout)
+{
+    // Print address as string so we don't have to do that every time
+    sensors_config[i].rom_code = layout->rom_codes[i];
+    snprintf(sensors_config[i].address, sizeof(sensors_config[i].address), "%llx", sensors_config[i].rom_code);
+    strcpy(sensors_config[i].name, sensors_config[i].address); // Default name is address
+
+    snprintf(sensors_config[i].name_param_name, sizeof(sensors_config[i].name_param_name), APP_RMAKER_DEF_SENSOR_NAME_NAME_F, sensors_config[i].address);
+    snprintf(sensors_config[i].offset_param_name, sizeof(sensors_config[i].offset_param_name), APP_RMAKER_DEF_SENSOR_OFFSET_NAME_F, sensors_config[i].address);
+    snprintf(sensors_config[i].curve_param_name, sizeof(sensors_config[i].curve_param_name), APP_RMAKER_DEF_SENSOR_CURVE_NAME_F, sensors_config[i].address);
+    snprintf(sensors_config[i].temperature_param_name, sizeof(sensors_config[i].temperature_param_name), APP_RMAKER_DEF_SENSOR_TEMPERATURE_NAME_F, sensors_config[i].address);
+    sensors_config[i].temperature_report = APP_REPORT_NONE;
+}
+
+static void apply_sensor_record(size_t i)
+{
+    const struct app_sensor_record *record = app_sensor_store_get(sensors_config[i].rom_code);
+    if (record)
+    {
+        strlcpy(sensors_config[i].name, record->name, sizeof(sensors_config[i].name));
+        sensors_config[i].offset_c = record->offset_c;
+        strlcpy(sensors_config[i].curve_points, record->curve_points, sizeof(sensors_config[i].curve_points));
+    }
+}
+
+static void update_sensor_presence(const struct app_sensors_layout *layout)
+{
+    for (size_t i = 0; i < known_sensor_count; i++)
+    {
+        sensors_config[i].bus = layout->buses[i];
+        sensors_config[i].present = layout->present[i];
+    }
+}
+
+static void store_sensor_presence()
+{
+    // Sensors no longer in their slot are not connected, collected first, since put reorders the records
+    size_t record_count = 0;
+    const struct app_sensor_record *records = app_sensor_store_records(&record_count);
+    uint64_t gone[APP_SENSOR_STORE_MAX_RECORDS] = {};
+    size_t gone_count = 0;
+    for (size_t r = 0; r < record_count; r++)
+    {
+        size_t slot = records[r].slot;
+        if (slot > 0 && (slot > known_sensor_count || sensors_config[slot - 1].rom_code != records[r].rom_code))
+        {
+            gone[gone_count++] = records[r].rom_code;
+        }
+    }
+    for (size_t k = 0; k < gone_count; k++)
+    {
+        struct app_sensor_record record = *app_sensor_store_get(gone[k]);
+        record.slot = 0;
+        store_sensor_record(&record);
+    }
+
+    // Connected ones remember their bus and slot, so next boot does not have to search
+    for (size_t i = 0; i < known_sensor_count; i++)
+    {
+        struct app_sensor_record record = {};
+        sensor_record(&sensors_config[i], &record);
+        const struct app_sensor_record *stored = app_sensor_store_get(record.rom_code);
+        if (!stored || stored->bus != record.bus || stored->slot != record.slot)
+        {
+            store_sensor_record(&record);
+        }
+    }
+}
+
+static esp_err_t add_sensor_param(esp_rmaker_device_t *device, esp_rmaker_param_t *param, app_params_handler_t handler, void *ctx)
+{
+    if (param == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = handler ? app_params_register(param, handler, ctx) : ESP_OK;
+    if (err == ESP_OK)
+    {
+        err = esp_rmaker_device_add_param(device, param);
+    }
+    return err;
+}
+
+// Called also after rescan, so errors must not abort, sensor is then left without rest of its params
+static esp_err_t add_sensor_params(esp_rmaker_device_t *device, size_t i)
+{
+    esp_rmaker_param_t *sensor_name_param = esp_rmaker_param_create(sensors_config[i].name_param_name, NULL, esp_rmaker_str(sensors_config[i].name), PROP_FLAG_READ | PROP_FLAG_WRITE);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_param_add_ui_type(sensor_name_param, ESP_RMAKER_UI_TEXT));
+    esp_err_t err = add_sensor_param(device, sensor_name_param, sensor_name_param_handler, &sensors_config[i]);
     if (err != ESP_OK)
     {
-        ESP_LOGW(TAG, "failed to open nvs storage");
         return err;
     }
-    char name[100] = {};
-    size_t name_len = sizeof(name);
-    nvs_get_str(handle, ESP_RMAKER_DEF_NAME_PARAM, name, &name_len);
-    nvs_close(handle);
 
-    // Build metrics string
-    char buf[1024] = {};
-    char *ptr = buf;
-    const char *end = ptr + sizeof(buf);
+    esp_rmaker_param_t *sensor_offset_param = esp_rmaker_param_create(sensors_config[i].offset_param_name, NULL, esp_rmaker_float(sensors_config[i].offset_c), PROP_FLAG_READ | PROP_FLAG_WRITE);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_param_add_ui_type(sensor_offset_param, ESP_RMAKER_UI_SLIDER));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_param_add_bounds(sensor_offset_param, esp_rmaker_float(-1.0f), esp_rmaker_float(1.0f), esp_rmaker_float(0.05f)));
+    err = add_sensor_param(device, sensor_offset_param, sensor_offset_param_handler, &sensors_config[i]);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
 
-    // Sensors
-    if (sensors)
+    esp_rmaker_param_t *sensor_curve_param = esp_rmaker_param_create(sensors_config[i].curve_param_name, NULL, esp_rmaker_str(sensors_config[i].curve_points), PROP_FLAG_READ | PROP_FLAG_WRITE);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_param_add_ui_type(sensor_curve_param, ESP_RMAKER_UI_TEXT));
+    err = add_sensor_param(device, sensor_curve_param, sensor_curve_param_handler, &sensors_config[i]);
+    if (err != ESP_OK)
     {
-        // Values
-        ptr = util_append(ptr, end, "# TYPE esp_celsius gauge\n");
-        for (size_t i = 0; i < sensors->count; i++)
+        return err;
+    }
+
+    // Measured value, read-only
+    esp_rmaker_param_t *sensor_temperature_param = esp_rmaker_param_create(sensors_config[i].temperature_param_name, ESP_RMAKER_PARAM_TEMPERATURE, esp_rmaker_float(0), PROP_FLAG_READ);
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_param_add_ui_type(sensor_temperature_param, ESP_RMAKER_UI_TEXT));
+    err = add_sensor_param(device, sensor_temperature_param, NULL, NULL);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    return app_report_add(sensor_temperature_param, false, APP_REPORT_TEMPERATURE_DEADBAND_MC / 1000.0f, &sensors_config[i].temperature_report);
+}
+
+static void app_devices_init(esp_rmaker_node_t *node)
+{
+    // Read device name from NVS, since rainmaker provides absolutely no means to get it directly
+    nvs_handle_t name_handle = 0;
+    if (nvs_open(APP_DEVICE_NAME, NVS_READONLY, &name_handle) == ESP_OK)
+    {
+        size_t name_len = sizeof(device_name);
+        nvs_get_str(name_handle, ESP_RMAKER_DEF_NAME_PARAM, device_name, &name_len);
+        nvs_close(name_handle);
+    }
+
+    size_t sensor_count = sensors ? sensors->count : 0;
+
+    // Reference config values, RainMaker uses them during its lifetime
+    for (size_t i = 0; i < sensor_count; i++)
+    {
+        sensor_addresses[i] = sensors_config[i].address;
+    }
+
+    // Device per zone, sensor config is on the first one, since sensors are shared by all zones
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        esp_rmaker_device_t *zone_device = app_zone_device_init(node, &zones[z], sensor_addresses, sensor_count);
+        if (!sensors_device)
         {
-            ptr = util_append(ptr, end, "esp_celsius{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %0.3f\n", sensors_config[i].address, name, sensors_config[i].name, temperatures[i]);
+            sensors_device = zone_device;
         }
+    }
 
-        // Errors
-        ptr = util_append(ptr, end, "# TYPE esp_errors counter\n");
-        for (size_t i = 0; i < sensors->count; i++)
+    // Sensors config
+    for (size_t i = 0; sensors_device && i < sensor_count; i++)
+    {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(add_sensor_params(sensors_device, i));
+    }
+}
+
+static void update_temperature_rate(size_t i, float temp_c)
+{
+    int64_t now = esp_timer_get_time();
+    if (temperature_times[i] > 0)
+    {
+        // Smoothed, since lower resolutions are coarse
+        float rate = (temp_c - temperatures[i]) * 1000000.0f / (float)(now - temperature_times[i]);
+        temperature_rates[i] = 0.7f * temperature_rates[i] + 0.3f * rate;
+    }
+    temperature_times[i] = now;
+}
+
+static void read_temperatures()
+{
+    ds18b20_group_read_all(sensors, sensor_results, DS18B20_GROUP_MAX_SIZE);
+
+    for (size_t i = 0; i < sensors->count; i++)
+    {
+        const struct ds18b20_group_result *result = &sensor_results[i];
+        if (!result->fresh)
         {
-            if (sensor_errors[i] > 0)
+            // Not due this cycle, keep last value
+            continue;
+        }
+
+        app_metrics_observe(APP_METRICS_STAGE_SENSOR_READ, result->duration_us);
+        if (result->status == ESP_OK && result->value_c > -70)
+        {
+            float temp_c = result->value_c + sensors_snapshot.offset_c[i];
+            update_temperature_rate(i, temp_c);
+            temperatures[i] = temp_c;
+            ESP_LOGI(TAG, "read temperature %s: %.3f C in %u us", sensors_snapshot.address[i], temp_c, result->duration_us);
+
+            // Glitch would otherwise drive the fan
+            if (!app_fusion_sensor_update(&sensor_filters[i], temp_c, result->timestamp))
             {
-                ptr = util_append(ptr, end, "esp_celsius{hardware=\"%s\"} %zu\n", name, sensor_errors[i]);
+                ESP_LOGW(TAG, "rejected temperature %s: %.3f C", sensors_snapshot.address[i], temp_c);
             }
         }
+        else
+        {
+            ++sensor_errors[i];
+            ESP_LOGW(TAG, "failed to read from %s", sensors_snapshot.address[i]);
+        }
+    }
+    temperatures_valid = true;
+
+#if APP_ADAPTIVE_RESOLUTION
+    // Only zone source sensors drive the fans, so only their distance to curve points of their zones matters
+    for (size_t i = 0; i < sensors->count; i++)
+    {
+        float distance_c = INFINITY;
+        for (size_t z = 0; z < zone_count; z++)
+        {
+            distance_c = fminf(distance_c, app_zone_curve_distance(&zones[z], i, temperatures[i]));
+        }
+        if (sensor_results[i].fresh)
+        {
+            ds18b20_group_adapt_resolution(sensors, i, temperature_rates[i], distance_c);
+        }
+    }
+#endif
+}
+
+static void apply_sensor_changes(__unused void *arg)
+{
+    // After boot, RainMaker data model is changed and params registered only from its own work queue
+    atomic_store(&sensors_layout_queued, false);
+    struct app_sensors_layout layout = {};
+    portENTER_CRITICAL(&sensors_layout_lock);
+    layout = sensors_layout;
+    portEXIT_CRITICAL(&sensors_layout_lock);
+
+    // Recursive, adding params may call write callback
+    xSemaphoreTakeRecursive(sensors_config_lock, portMAX_DELAY);
+
+    // Connected or disconnected sensors
+    for (size_t i = 0; i < known_sensor_count; i++)
+    {
+        if (sensors_config[i].present != layout.present[i])
+        {
+            ESP_LOGW(TAG, "sensor %s %s", sensors_config[i].address, layout.present[i] ? "reconnected" : "disconnected");
+        }
+    }
+
+    // New sensors get their config from previous connection, if any
+    bool added = layout.count > known_sensor_count;
+    for (size_t i = known_sensor_count; i < layout.count; i++)
+    {
+        init_sensor_config(i, &layout);
+        apply_sensor_record(i);
+        sensor_addresses[i] = sensors_config[i].address;
+        if (sensors_device && add_sensor_params(sensors_device, i) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "failed to add params of sensor %s", sensors_config[i].address);
+        }
+        ESP_LOGI(TAG, "sensor %s connected", sensors_config[i].address);
     }
+    known_sensor_count = layout.count;
 
-    // Fan
-    ptr = util_append(ptr, end, "# TYPE esp_rpm gauge\n");
-    ptr = util_append(ptr, end, "esp_rpm{hardware=\"%s\",sensor=\"Fan\"} %u\n", name, pc_fan_rpm_sampling_last_rpm(rpm));
+    update_sensor_presence(&layout);
+    store_sensor_presence();
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        update_zone_sources(&zones[z]);
+    }
+    publish_sensors_config();
 
-    ptr = util_append(ptr, end, "# TYPE esp_rpm_total counter\n");
-    ptr = util_append(ptr, end, "esp_rpm_total{hardware=\"%s\",sensor=\"Fan\"} %d\n", name, pc_fan_rpm_sampling_last_count(rpm));
+    if (added)
+    {
+        for (size_t z = 0; z < zone_count; z++)
+        {
+            if (zones_primary_sensor_param[z])
+            {
+                ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_param_add_valid_str_list(zones_primary_sensor_param[z], sensor_addresses, known_sensor_count));
+            }
+        }
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_report_node_details());
+    }
+    xSemaphoreGiveRecursive(sensors_config_lock);
+}
 
-    ptr = util_append(ptr, end, "# TYPE esp_duty gauge\n");
-    ptr = util_append(ptr, end, "esp_duty{hardware=\"%s\",sensor=\"Fan\"} %d\n", name, (int)(fan_duty_percent * 100.0f));
+static bool queue_sensor_changes()
+{
+    portENTER_CRITICAL(&sensors_layout_lock);
+    capture_sensors_layout(&sensors_layout);
+    portEXIT_CRITICAL(&sensors_layout_lock);
 
-    // Send result
-    if (ptr != NULL)
+    // Single pending work is enough, it applies the newest layout
+    if (!atomic_exchange(&sensors_layout_queued, true))
     {
-        // Send data
-        httpd_resp_set_type(r, "text/plain");
-        return httpd_resp_send(r, buf, (ssize_t)(ptr - buf));
+        esp_err_t err = esp_rmaker_work_queue_add_task(apply_sensor_changes, NULL);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "failed to queue sensor changes: %d %s", err, esp_err_to_name(err));
+            atomic_store(&sensors_layout_queued, false);
+            return false;
+        }
     }
-    else
+    return true;
+}
+
+static bool rescan_step()
+{
+    // Single search step per cycle, so a pass never delays control noticeably
+    int64_t now = esp_timer_get_time();
+    if (rescan_next == 0)
+    {
+        // Verify cached sensors once setup completes, since new sensors need RainMaker devices for their params
+        if (APP_SENSOR_RESCAN_INTERVAL == 0 || (xEventGroupGetBits(boot_events) & BOOT_COMPLETE) == 0)
+        {
+            return false;
+        }
+        rescan_next = now;
+    }
+    if (!sensors->rescan.active && now < rescan_next)
+    {
+        return false;
+    }
+
+    bool changed = false;
+    bool done = false;
+    esp_err_t err = ds18b20_group_rescan_step(sensors, &changed, &done);
+    if (err != ESP_OK)
     {
-        // Buffer overflow
-        return ESP_FAIL;
+        ESP_LOGW(TAG, "sensor rescan failed: %d %s", err, esp_err_to_name(err));
     }
+    if (err != ESP_OK || done)
+    {
+        rescan_next = now + (int64_t)APP_SENSOR_RESCAN_INTERVAL * 1000000;
+    }
+    return changed;
 }
 
-static void loop()
+static void rescan_sensors()
 {
-    // Read temperatures
+    // Changes are retried until the work queue takes them
+    static bool pending = false;
+    pending |= rescan_step();
+    if (pending)
+    {
+        pending = !queue_sensor_changes();
+    }
+}
+
+static void acquire()
+{
+    int64_t start = esp_timer_get_time();
+    if (sensors)
+    {
+        // Config changed by other tasks meanwhile
+        apply_sensors_config();
+    }
     if (sensors && sensors->count > 0)
     {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_convert(sensors));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_wait_for_conversion(sensors));
+        // Pipelined acquisition - collect finished conversion, and immediately start next one,
+        // so it runs in the background until next tick
+        bool ready = false;
+        int64_t conversion_start = sensors->conversion_start;
+        esp_err_t err = ds18b20_group_conversion_ready(sensors, &ready);
+        if (ready)
+        {
+            app_metrics_observe(APP_METRICS_STAGE_CONVERSION, esp_timer_get_time() - conversion_start);
+            read_temperatures();
+        }
+        if (ready || err == ESP_ERR_INVALID_STATE)
+        {
+            // Bus is idle between conversions
+            rescan_sensors();
+            int64_t convert_start = esp_timer_get_time();
+            ESP_ERROR_CHECK_WITHOUT_ABORT(ds18b20_group_convert(sensors));
+            app_metrics_observe(APP_METRICS_STAGE_CONVERT, esp_timer_get_time() - convert_start);
+        }
+    }
+    else if (sensors)
+    {
+        // Nothing connected yet
+        rescan_sensors();
+    }
 
-        for (size_t i = 0; i < sensors->count; i++)
+    // Control input, stale sensors are skipped by zones
+    struct app_sensors_frame *frame = util_triple_back(&sensors_channel);
+    int64_t now = esp_timer_get_time();
+    frame->ready = temperatures_valid;
+    frame->count = sensors ? sensors->count : 0;
+    for (size_t i = 0; i < frame->count; i++)
+    {
+        frame->valid[i] = app_fusion_sensor_valid(&sensor_filters[i], now, sensor_max_age_us(i));
+        frame->filtered_c[i] = sensor_filters[i].value_c;
+    }
+    util_triple_publish(&sensors_channel);
+
+    // Telemetry
+    struct app_sensors_stats *stats = util_triple_back(&stats_channel);
+    stats->count = frame->count;
+    stats->conversion_ms = ds18b20_group_conversion_time_ms(sensors);
+    for (size_t i = 0; i < stats->count; i++)
+    {
+        struct app_metrics_sensor *sensor = &stats->sensors[i];
+        strlcpy(sensor->address, sensors_snapshot.address[i], sizeof(sensor->address));
+        strlcpy(sensor->name, sensors_snapshot.name[i], sizeof(sensor->name));
+        sensor->temperature_c = temperatures[i];
+        sensor->errors = sensor_errors[i];
+        sensor->read_us = sensor_results[i].duration_us;
+        sensor->read_timestamp = sensor_results[i].timestamp;
+        sensor->resolution_bits = (uint8_t)ds18b20_group_get_resolution(sensors, i);
+        sensor->filtered_c = frame->filtered_c[i];
+        sensor->valid = frame->valid[i];
+        sensor->rejected = sensor_filters[i].rejected;
+    }
+    util_triple_publish(&stats_channel);
+
+    // Control reacts to new readings right away
+    xTaskNotifyGive(control_task_handle);
+
+    // Overrun delays next cycle, vTaskDelayUntil() then returns immediately
+    int64_t duration_us = esp_timer_get_time() - start;
+    app_metrics_observe(APP_METRICS_STAGE_ACQUISITION, duration_us);
+    if (duration_us > APP_CONTROL_LOOP_INTERVAL * 1000)
+    {
+        app_metrics_count(APP_METRICS_SENSOR_OVERRUNS);
+    }
+}
+
+static void sensors_task(__unused void *arg)
+{
+    app_sensors_init();
+    app_metrics_boot_stage(APP_METRICS_BOOT_SENSORS);
+    xEventGroupSetBits(boot_events, BOOT_SENSORS_READY);
+
+    // First frame as soon as the first conversion finishes, instead of after whole interval
+    if (sensors && sensors->count > 0 && ds18b20_group_convert(sensors) == ESP_OK)
+    {
+        vTaskDelay(ds18b20_group_conversion_time_ms(sensors) / portTICK_PERIOD_MS + 1);
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    for (;;)
+    {
+        acquire();
+        vTaskDelayUntil(&start, APP_CONTROL_LOOP_INTERVAL / portTICK_PERIOD_MS);
+    }
+}
+
+static void check_health(float dt_s)
+{
+    // Stalled fan forces all fans to full speed, so the rest of them compensate
+    bool failsafe = false;
+    int64_t now = esp_timer_get_time();
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        struct app_zone *zone = &zones[z];
+        if (zone->hw.rpm_pin < 0 || zone->sweep.active)
         {
-            float temp_c = -127;
-            if (ds18b20_group_read_single(sensors, i, &temp_c) == ESP_OK && temp_c > -70)
-            {
-                temp_c += sensors_config[i].offset_c;
-                temperatures[i] = temp_c;
-                ESP_LOGI(TAG, "read temperature %s: %.3f C", sensors_config[i].address, temp_c);
-            }
-            else
+            // Nothing to check, or deliberately stopped by calibration
+            continue;
+        }
+
+        if (app_health_update(&zone->health, zone->duty_percent, app_zone_rpm(zone), &zone->calibration, now, dt_s))
+        {
+            // Alert is raised by telemetry
+            ESP_LOGW(TAG, "%s health changed to %s", zone->name, app_health_status_name(zone->health.status));
+        }
+        failsafe |= zone->health.status == APP_HEALTH_STALLED;
+    }
+
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        zones[z].failsafe = failsafe;
+    }
+}
+
+static void control(const struct app_sensors_frame *frame, float dt_s)
+{
+    // Check fans before control, so failsafe applies in the same cycle
+    check_health(dt_s);
+
+    // Control all zones from the same acquisition pass
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        struct app_zone *zone = &zones[z];
+        if (frame->ready)
+        {
+            // Source temperatures, from newest finished conversion
+            app_zone_control(zone, frame->filtered_c, frame->valid, dt_s);
+            ESP_LOGI(TAG, "%s temperature: %.3f C", zone->name, zone->input_c);
+        }
+        else
+        {
+            // Fallback mode, also used until first conversion finishes
+            app_zone_fallback(zone);
+        }
+        ESP_LOGI(TAG, "%s rpm: %d", zone->name, app_zone_rpm(zone));
+    }
+
+    // Telemetry
+    struct app_control_frame *out = util_triple_back(&control_channel);
+    out->fan_count = zone_count;
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        struct app_zone *zone = &zones[z];
+        struct app_metrics_fan *fan = &out->fans[z];
+        strlcpy(fan->name, zone->name, sizeof(fan->name));
+        fan->rpm = app_zone_rpm(zone);
+        fan->rpm_count = app_zone_rpm_count(zone);
+        fan->duty_percent = zone->duty_percent;
+        fan->rpm_target = zone->rpm_target;
+        fan->health = app_health_value(&zone->health);
+        fan->stalls = zone->health.stalls;
+        fan->input_c = zone->input_c;
+        fan->input_valid = zone->input_valid;
+
+        fan->pid_active = zone->active_mode == APP_ZONE_MODE_PID;
+        fan->pid_setpoint_c = zone->pid.setpoint_c;
+        fan->pid_p = zone->pid.p_term;
+        fan->pid_i = zone->pid.i_term;
+        fan->pid_d = zone->pid.d_term;
+        fan->pid_ff = zone->pid.ff_term;
+
+        out->calibrating[z] = zone->sweep.active;
+        out->calibration[z] = zone->calibration;
+        out->health[z] = zone->health.status;
+    }
+    util_triple_publish(&control_channel);
+}
+
+static void control_task(__unused void *arg)
+{
+    bool started = false;
+    int64_t last = esp_timer_get_time();
+    for (;;)
+    {
+        // New readings are applied right away, slow or stuck bus never delays control past the interval
+        ulTaskNotifyTake(pdTRUE, CONTROL_DEADLINE_MS / portTICK_PERIOD_MS);
+        int64_t now = esp_timer_get_time();
+        float dt_s = (float)(now - last) / 1000000.0f;
+        if (started && now - last > (int64_t)(CONTROL_DEADLINE_MS + portTICK_PERIOD_MS) * 1000)
+        {
+            // Timeout is in ticks, so it may fire up to one tick late
+            app_metrics_count(APP_METRICS_CONTROL_DEADLINE_MISSES);
+        }
+        last = now;
+
+        bool fresh = false;
+        const struct app_sensors_frame *frame = util_triple_front(&sensors_channel, &fresh);
+        control(frame, dt_s);
+        app_metrics_observe(APP_METRICS_STAGE_CONTROL, esp_timer_get_time() - now);
+
+        if (fresh && !started)
+        {
+            // From the first conversion, or right after discovery when there are no sensors
+            started = true;
+            app_metrics_boot_stage(APP_METRICS_BOOT_FIRST_CONTROL);
+            ESP_LOGI(TAG, "first control in %d ms", (int)(now / 1000));
+            xEventGroupSetBits(boot_events, BOOT_FIRST_CONTROL);
+        }
+    }
+}
+
+static void publish_metrics(const struct app_sensors_stats *stats, const struct app_control_frame *control)
+{
+    struct app_metrics_snapshot *snapshot = app_metrics_begin();
+    if (!snapshot)
+    {
+        return;
+    }
+
+    snapshot->timestamp = esp_timer_get_time();
+    strlcpy(snapshot->hardware, device_name, sizeof(snapshot->hardware));
+
+    snapshot->sensor_count = stats->count;
+    snapshot->conversion_ms = stats->conversion_ms;
+    memcpy(snapshot->sensors, stats->sensors, stats->count * sizeof(*stats->sensors));
+
+    snapshot->fan_count = control->fan_count;
+    memcpy(snapshot->fans, control->fans, control->fan_count * sizeof(*control->fans));
+
+    app_metrics_publish();
+}
+
+static void append_history(const struct app_sensors_stats *stats, const struct app_control_frame *control)
+{
+    // Sensors found by rescan are added once they have config, after zones, so older samples keep their columns
+    for (size_t i = history_sensor_count + history_added_count; i < stats->count && stats->sensors[i].address[0] != '\0'; i++)
+    {
+        struct app_history_channel channel = {.name = sensors_config[i].address, .scale = 100};
+        if (app_history_add_channel(&channel) != ESP_OK)
+        {
+            break;
+        }
+        history_added_count++;
+    }
+
+    float values[APP_HISTORY_MAX_CHANNELS];
+    size_t count = 0;
+    for (size_t i = 0; i < history_sensor_count; i++)
+    {
+        values[count++] = stats->sensors[i].valid ? stats->sensors[i].temperature_c : NAN;
+    }
+    for (size_t z = 0; z < zone_count; z++)
+    {
+        values[count++] = (float)control->fans[z].rpm;
+        values[count++] = control->fans[z].duty_percent * 100.0f;
+    }
+    for (size_t i = history_sensor_count; i < history_sensor_count + history_added_count; i++)
+    {
+        values[count++] = stats->sensors[i].valid ? stats->sensors[i].temperature_c : NAN;
+    }
+
+    app_history_append(esp_timer_get_time() / 1000, values);
+}
+
+static void stream_record(const struct app_sensors_stats *stats, const struct app_control_frame *control)
+{
+    size_t size = 0;
+    char *buf = app_stream_begin(&size);
+    if (!buf)
+    {
+        return;
+    }
+
+    // Compact JSON, invalid sensors are null
+    const char *end = buf + size;
+    char *p = util_append(buf, end, "data: {\"t\":%lld,\"temperatures\":[", (long long)(esp_timer_get_time() / 1000));
+    for (size_t i = 0; i < stats->count; i++)
+    {
+        const char *sep = i > 0 ? "," : "";
+        p = stats->sensors[i].valid ? util_append(p, end, "%s%.2f", sep, stats->sensors[i].temperature_c) : util_append(p, end, "%snull", sep);
+    }
+    p = util_append(p, end, "],\"rpm\":[");
+    for (size_t z = 0; z < control->fan_count; z++)
+    {
+        p = util_append(p, end, "%s%u", z > 0 ? "," : "", control->fans[z].rpm);
+    }
+    p = util_append(p, end, "],\"duty\":[");
+    for (size_t z = 0; z < control->fan_count; z++)
+    {
+        p = util_append(p, end, "%s%.1f", z > 0 ? "," : "", control->fans[z].duty_percent * 100.0f);
+    }
+    p = util_append(p, end, "]}\n\n");
+
+    // Too long record is dropped
+    app_stream_publish(p ? (size_t)(p - buf) : 0);
+}
+
+static void telemetry()
+{
+    static bool calibrating[APP_ZONE_MAX_COUNT] = {};
+    static enum app_health_status health[APP_ZONE_MAX_COUNT] = {};
+
+    const struct app_sensors_stats *stats = util_triple_front(&stats_channel, NULL);
+    const struct app_control_frame *control = util_triple_front(&control_channel, NULL);
+
+    // Anything that talks to the network is done here, never by the control task
+    for (size_t z = 0; z < control->fan_count; z++)
+    {
+        if (calibrating[z] && !control->calibrating[z])
+        {
+            ESP_ERROR_CHECK_WITHOUT_ABORT(app_zone_calibration_store(&zones[z], &control->calibration[z]));
+            if (zones_calibrate_param[z])
             {
-                ++sensor_errors[i];
-                ESP_LOGW(TAG, "failed to read from %s", sensors_config[i].address);
+                esp_rmaker_param_update_and_report(zones_calibrate_param[z], esp_rmaker_bool(false));
             }
         }
+        calibrating[z] = control->calibrating[z];
 
-        // Find primary temperature
-        float primary_temp_c = temperatures[primary_sensor_index < sensors->count ? primary_sensor_index : 0];
-        ESP_LOGI(TAG, "primary temperature: %.3f C", primary_temp_c);
+        if (control->health[z] != health[z] && control->health[z] != APP_HEALTH_OK)
+        {
+            char alert[64] = {};
+            snprintf(alert, sizeof(alert), "%s %s", control->fans[z].name, app_health_status_name(control->health[z]));
+            ESP_ERROR_CHECK_WITHOUT_ABORT(esp_rmaker_raise_alert(alert));
+        }
+        health[z] = control->health[z];
+    }
 
-        // Limit to range
-        float temp_in_range = primary_temp_c < low_temperature_threshold ? low_temperature_threshold : (primary_temp_c > high_temperature_threshold ? high_temperature_threshold : primary_temp_c);
-        // Map temperature range to duty cycle
-        float duty_percent = (temp_in_range - low_temperature_threshold) * (high_duty_percent - low_duty_percent) / (high_temperature_threshold - low_temperature_threshold) + low_duty_percent;
+    // Make current state available to the HTTP server
+    publish_metrics(stats, control);
+    append_history(stats, control);
+    stream_record(stats, control);
+
+    // Cloud gets only significant changes, batched into a single message
+    for (size_t i = 0; i < stats->count; i++)
+    {
+        if (stats->sensors[i].valid)
+        {
+            app_report_set(sensors_config[i].temperature_report, stats->sensors[i].temperature_c);
+        }
+    }
+    for (size_t z = 0; z < control->fan_count; z++)
+    {
+        app_report_set(zones_rpm_report[z], (float)control->fans[z].rpm);
+        app_report_set(zones_duty_report[z], control->fans[z].duty_percent * 100.0f);
+    }
+    app_report_flush();
 
-        // Control fan
-        set_fan_duty(force_max_duty ? high_duty_percent : duty_percent);
+    // Collector gets every sample, in batches, name is taken once per cycle, like for metrics
+    app_push_set_hardware(device_name);
+    for (size_t i = 0; i < stats->count; i++)
+    {
+        if (stats->sensors[i].valid)
+        {
+            app_push_gauge("esp_celsius", "address", stats->sensors[i].address, stats->sensors[i].temperature_c, false);
+        }
     }
-    else
+    for (size_t z = 0; z < control->fan_count; z++)
     {
-        // Fallback mode
-        set_fan_duty(high_duty_percent);
+        app_push_gauge("esp_rpm", "sensor", control->fans[z].name, (float)control->fans[z].rpm, true);
+        app_push_gauge("esp_duty", "sensor", control->fans[z].name, control->fans[z].duty_percent * 100.0f, true);
     }
+    app_push_flush();
 
-    ESP_LOGI(TAG, "rpm: %d", pc_fan_rpm_sampling_last_rpm(rpm));
+    // Config changes, once they settle
+    app_config_flush_idle();
 }
 
 _Noreturn void app_main()
 {
     setup();
 
-    // Run
+    // Main task does telemetry, control and acquisition have their own tasks
     TickType_t start = xTaskGetTickCount();
     uint8_t blink_counter = 0;
 
@@ -589,7 +1841,6 @@ _Noreturn void app_main()
         // Throttle
         vTaskDelayUntil(&start, APP_CONTROL_LOOP_INTERVAL / portTICK_PERIOD_MS);
 
-        // Run control loop
-        loop();
+        telemetry();
     }
 }
@@ -0,0 +1,315 @@
+#include "app_metrics.h"
+#include "util/util_chunked.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdatomic.h>
+
+static const char TAG[] = "app_metrics";
+
+// Double buffer, front buffer is snapshots[snapshot_seq & 1].
+// Readers pin the buffer they read, writer skips publishing while its back buffer is pinned,
+// so readers never see half-updated state and nobody ever blocks.
+static struct app_metrics_snapshot snapshots[2] = {};
+static atomic_uint snapshot_seq = 0;
+static atomic_int snapshot_readers[2] = {};
+
+// Written once by boot code, esp_timer_get_time() of each stage, 0 until reached
+static _Atomic int64_t boot_stages[APP_METRICS_BOOT_STAGE_COUNT] = {};
+static const char *boot_stage_names[APP_METRICS_BOOT_STAGE_COUNT] = {"safe_duty", "sensors", "first_control", "wifi", "rainmaker", "ready"};
+
+// Fixed buckets, upper bounds in us, last one is +Inf. Counts are per bucket, cumulated on export.
+#define APP_METRICS_BUCKET_COUNT 15
+static const uint32_t bucket_bounds_us[APP_METRICS_BUCKET_COUNT - 1] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000};
+static struct app_metrics_histogram
+{
+    atomic_uint buckets[APP_METRICS_BUCKET_COUNT];
+    _Atomic uint64_t sum_us;
+} histograms[APP_METRICS_STAGE_COUNT] = {};
+static const char *stage_names[APP_METRICS_STAGE_COUNT] = {"convert", "conversion", "sensor_read", "acquisition", "control", "pwm", "http"};
+static atomic_uint counters[APP_METRICS_COUNTER_COUNT] = {};
+
+struct app_metrics_snapshot *app_metrics_begin()
+{
+    unsigned int back = (atomic_load(&snapshot_seq) + 1) & 1;
+    if (atomic_load(&snapshot_readers[back]) > 0)
+    {
+        ESP_LOGD(TAG, "snapshot skipped, still being read");
+        return NULL;
+    }
+    return &snapshots[back];
+}
+
+void app_metrics_publish()
+{
+    atomic_fetch_add(&snapshot_seq, 1);
+}
+
+void app_metrics_boot_stage(enum app_metrics_boot_stage stage)
+{
+    if (stage < APP_METRICS_BOOT_STAGE_COUNT)
+    {
+        int64_t expected = 0;
+        atomic_compare_exchange_strong(&boot_stages[stage], &expected, esp_timer_get_time());
+    }
+}
+
+void app_metrics_observe(enum app_metrics_stage stage, int64_t duration_us)
+{
+    if (stage >= APP_METRICS_STAGE_COUNT || duration_us < 0)
+    {
+        return;
+    }
+
+    size_t bucket = 0;
+    while (bucket < APP_METRICS_BUCKET_COUNT - 1 && duration_us > bucket_bounds_us[bucket])
+    {
+        bucket++;
+    }
+    struct app_metrics_histogram *histogram = &histograms[stage];
+    atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum_us, (uint64_t)duration_us, memory_order_relaxed);
+}
+
+void app_metrics_count(enum app_metrics_counter counter)
+{
+    app_metrics_add(counter, 1);
+}
+
+void app_metrics_add(enum app_metrics_counter counter, uint32_t n)
+{
+    if (counter < APP_METRICS_COUNTER_COUNT)
+    {
+        atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+    }
+}
+
+static const struct app_metrics_snapshot *app_metrics_acquire(unsigned int *index)
+{
+    for (;;)
+    {
+        unsigned int seq = atomic_load(&snapshot_seq);
+        *index = seq & 1;
+        atomic_fetch_add(&snapshot_readers[*index], 1);
+
+        // Writer could have started on this buffer before it was pinned, that always moves the sequence
+        if (atomic_load(&snapshot_seq) == seq)
+        {
+            return &snapshots[*index];
+        }
+        atomic_fetch_sub(&snapshot_readers[*index], 1);
+    }
+}
+
+static void app_metrics_release(unsigned int index)
+{
+    atomic_fetch_sub(&snapshot_readers[index], 1);
+}
+
+esp_err_t app_metrics_http_handler(httpd_req_t *r)
+{
+    int64_t start = esp_timer_get_time();
+    unsigned int index = 0;
+    const struct app_metrics_snapshot *s = app_metrics_acquire(&index);
+    const char *name = s->hardware;
+
+    // Stream metrics in small chunks, so the size is not limited by a buffer
+    httpd_resp_set_type(r, "text/plain");
+    struct util_chunked out;
+    util_chunked_init(&out, r);
+
+    // Sensors
+    if (s->sensor_count > 0)
+    {
+        // Values
+        util_chunked_append(&out, "# TYPE esp_celsius gauge\n");
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            util_chunked_append(&out, "esp_celsius{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %0.3f\n", s->sensors[i].address, name, s->sensors[i].name, s->sensors[i].temperature_c);
+        }
+
+        // Errors
+        util_chunked_append(&out, "# TYPE esp_errors counter\n");
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            if (s->sensors[i].errors > 0)
+            {
+                util_chunked_append(&out, "esp_errors{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %zu\n", s->sensors[i].address, name, s->sensors[i].name, s->sensors[i].errors);
+            }
+        }
+
+        // Bus time spent per sensor, including retries
+        util_chunked_append(&out, "# TYPE esp_sensor_read_seconds gauge\n");
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            util_chunked_append(&out, "esp_sensor_read_seconds{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %0.6f\n", s->sensors[i].address, name, s->sensors[i].name, (float)s->sensors[i].read_us / 1000000.0f);
+        }
+
+        // Age of last successful read, secondary sensors are read less often
+        util_chunked_append(&out, "# TYPE esp_sensor_age_seconds gauge\n");
+        int64_t now = esp_timer_get_time();
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            if (s->sensors[i].read_timestamp > 0)
+            {
+                util_chunked_append(&out, "esp_sensor_age_seconds{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %0.3f\n", s->sensors[i].address, name, s->sensors[i].name, (float)(now - s->sensors[i].read_timestamp) / 1000000.0f);
+            }
+        }
+
+        // Resolution
+        util_chunked_append(&out, "# TYPE esp_sensor_resolution_bits gauge\n");
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            util_chunked_append(&out, "esp_sensor_resolution_bits{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %u\n", s->sensors[i].address, name, s->sensors[i].name, s->sensors[i].resolution_bits);
+        }
+
+        // Fusion, values actually used for control
+        util_chunked_append(&out, "# TYPE esp_sensor_filtered_celsius gauge\n");
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            util_chunked_append(&out, "esp_sensor_filtered_celsius{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %0.3f\n", s->sensors[i].address, name, s->sensors[i].name, s->sensors[i].filtered_c);
+        }
+
+        util_chunked_append(&out, "# TYPE esp_sensor_valid gauge\n");
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            util_chunked_append(&out, "esp_sensor_valid{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %d\n", s->sensors[i].address, name, s->sensors[i].name, s->sensors[i].valid ? 1 : 0);
+        }
+
+        util_chunked_append(&out, "# TYPE esp_sensor_rejected counter\n");
+        for (size_t i = 0; i < s->sensor_count; i++)
+        {
+            util_chunked_append(&out, "esp_sensor_rejected{address=\"%s\",hardware=\"%s\",sensor=\"%s\"} %u\n", s->sensors[i].address, name, s->sensors[i].name, s->sensors[i].rejected);
+        }
+
+        util_chunked_append(&out, "# TYPE esp_sensor_conversion_seconds gauge\n");
+        util_chunked_append(&out, "esp_sensor_conversion_seconds{hardware=\"%s\"} %0.3f\n", name, (float)s->conversion_ms / 1000.0f);
+    }
+
+    // Fans
+    util_chunked_append(&out, "# TYPE esp_rpm gauge\n");
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        util_chunked_append(&out, "esp_rpm{hardware=\"%s\",sensor=\"%s\"} %u\n", name, s->fans[i].name, s->fans[i].rpm);
+    }
+
+    util_chunked_append(&out, "# TYPE esp_rpm_total counter\n");
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        util_chunked_append(&out, "esp_rpm_total{hardware=\"%s\",sensor=\"%s\"} %u\n", name, s->fans[i].name, s->fans[i].rpm_count);
+    }
+
+    util_chunked_append(&out, "# TYPE esp_rpm_target gauge\n");
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        if (s->fans[i].rpm_target > 0)
+        {
+            util_chunked_append(&out, "esp_rpm_target{hardware=\"%s\",sensor=\"%s\"} %u\n", name, s->fans[i].name, s->fans[i].rpm_target);
+        }
+    }
+
+    util_chunked_append(&out, "# TYPE esp_duty gauge\n");
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        util_chunked_append(&out, "esp_duty{hardware=\"%s\",sensor=\"%s\"} %d\n", name, s->fans[i].name, (int)(s->fans[i].duty_percent * 100.0f));
+    }
+
+    util_chunked_append(&out, "# TYPE esp_fan_input_celsius gauge\n");
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        if (s->fans[i].input_valid)
+        {
+            util_chunked_append(&out, "esp_fan_input_celsius{hardware=\"%s\",sensor=\"%s\"} %0.3f\n", name, s->fans[i].name, s->fans[i].input_c);
+        }
+    }
+
+    // Health, 1 for healthy, 0 for stalled fan
+    util_chunked_append(&out, "# TYPE esp_fan_health gauge\n");
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        util_chunked_append(&out, "esp_fan_health{hardware=\"%s\",sensor=\"%s\"} %0.3f\n", name, s->fans[i].name, s->fans[i].health);
+    }
+
+    util_chunked_append(&out, "# TYPE esp_fan_stalls counter\n");
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        util_chunked_append(&out, "esp_fan_stalls{hardware=\"%s\",sensor=\"%s\"} %u\n", name, s->fans[i].name, s->fans[i].stalls);
+    }
+
+    // Controller internals, only for fans in PID mode
+    bool pid_active = false;
+    for (size_t i = 0; i < s->fan_count; i++)
+    {
+        pid_active |= s->fans[i].pid_active;
+    }
+    if (pid_active)
+    {
+        util_chunked_append(&out, "# TYPE esp_pid_setpoint_celsius gauge\n");
+        for (size_t i = 0; i < s->fan_count; i++)
+        {
+            if (s->fans[i].pid_active)
+            {
+                util_chunked_append(&out, "esp_pid_setpoint_celsius{hardware=\"%s\",sensor=\"%s\"} %0.3f\n", name, s->fans[i].name, s->fans[i].pid_setpoint_c);
+            }
+        }
+
+        util_chunked_append(&out, "# TYPE esp_pid_term gauge\n");
+        for (size_t i = 0; i < s->fan_count; i++)
+        {
+            const struct app_metrics_fan *fan = &s->fans[i];
+            if (fan->pid_active)
+            {
+                util_chunked_append(&out, "esp_pid_term{hardware=\"%s\",sensor=\"%s\",term=\"p\"} %0.4f\n", name, fan->name, fan->pid_p);
+                util_chunked_append(&out, "esp_pid_term{hardware=\"%s\",sensor=\"%s\",term=\"i\"} %0.4f\n", name, fan->name, fan->pid_i);
+                util_chunked_append(&out, "esp_pid_term{hardware=\"%s\",sensor=\"%s\",term=\"d\"} %0.4f\n", name, fan->name, fan->pid_d);
+                util_chunked_append(&out, "esp_pid_term{hardware=\"%s\",sensor=\"%s\",term=\"ff\"} %0.4f\n", name, fan->name, fan->pid_ff);
+            }
+        }
+    }
+
+    // Boot timeline, so time to first control can be compared across firmware versions
+    util_chunked_append(&out, "# TYPE esp_boot_stage_seconds gauge\n");
+    for (size_t i = 0; i < APP_METRICS_BOOT_STAGE_COUNT; i++)
+    {
+        int64_t at = atomic_load(&boot_stages[i]);
+        if (at > 0)
+        {
+            util_chunked_append(&out, "esp_boot_stage_seconds{hardware=\"%s\",stage=\"%s\"} %0.3f\n", name, boot_stage_names[i], (float)at / 1000000.0f);
+        }
+    }
+
+    // Latencies, read while being updated, so a histogram may be off by the few samples recorded meanwhile
+    util_chunked_append(&out, "# TYPE esp_stage_seconds histogram\n");
+    for (size_t i = 0; i < APP_METRICS_STAGE_COUNT; i++)
+    {
+        struct app_metrics_histogram *histogram = &histograms[i];
+        uint32_t count = 0;
+        for (size_t b = 0; b < APP_METRICS_BUCKET_COUNT; b++)
+        {
+            count += atomic_load_explicit(&histogram->buckets[b], memory_order_relaxed);
+            if (b < APP_METRICS_BUCKET_COUNT - 1)
+            {
+                util_chunked_append(&out, "esp_stage_seconds_bucket{hardware=\"%s\",stage=\"%s\",le=\"%g\"} %u\n", name, stage_names[i], (double)bucket_bounds_us[b] / 1000000.0, count);
+            }
+            else
+            {
+                util_chunked_append(&out, "esp_stage_seconds_bucket{hardware=\"%s\",stage=\"%s\",le=\"+Inf\"} %u\n", name, stage_names[i], count);
+            }
+        }
+        uint64_t sum_us = atomic_load_explicit(&histogram->sum_us, memory_order_relaxed);
+        util_chunked_append(&out, "esp_stage_seconds_sum{hardware=\"%s\",stage=\"%s\"} %0.6f\n", name, stage_names[i], (double)sum_us / 1000000.0);
+        util_chunked_append(&out, "esp_stage_seconds_count{hardware=\"%s\",stage=\"%s\"} %u\n", name, stage_names[i], count);
+    }
+
+    util_chunked_append(&out, "# TYPE esp_control_deadline_misses counter\n");
+    util_chunked_append(&out, "esp_control_deadline_misses{hardware=\"%s\"} %u\n", name, atomic_load(&counters[APP_METRICS_CONTROL_DEADLINE_MISSES]));
+    util_chunked_append(&out, "# TYPE esp_sensor_overruns counter\n");
+    util_chunked_append(&out, "esp_sensor_overruns{hardware=\"%s\"} %u\n", name, atomic_load(&counters[APP_METRICS_SENSOR_OVERRUNS]));
+    util_chunked_append(&out, "# TYPE esp_push_drops counter\n");
+    util_chunked_append(&out, "esp_push_drops{hardware=\"%s\"} %u\n", name, atomic_load(&counters[APP_METRICS_PUSH_DROPS]));
+
+    app_metrics_release(index);
+
+    // Send rest and terminate, rendering is measured without the final send
+    app_metrics_observe(APP_METRICS_STAGE_HTTP, esp_timer_get_time() - start);
+    return util_chunked_finish(&out);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "app_zone.h"
+#include <ds18b20_group.h>
+#include <esp_http_server.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_METRICS_HARDWARE_NAME_LEN 100
+
+struct app_metrics_sensor
+{
+    char address[17];
+    char name[33];
+    float temperature_c;
+    size_t errors;
+    uint32_t read_us;
+    int64_t read_timestamp; // esp_timer_get_time() of last successful read, 0 if never
+    uint8_t resolution_bits;
+    float filtered_c;
+    bool valid; // Fresh and not rejected, used for control
+    uint32_t rejected;
+};
+
+struct app_metrics_fan
+{
+    char name[APP_ZONE_NAME_LEN];
+    uint16_t rpm;
+    uint32_t rpm_count;
+    uint16_t rpm_target; // 0 unless in RPM mode
+    float duty_percent;
+    float health;
+    uint32_t stalls;
+    float input_c; // Combined temperature of zone sources
+    bool input_valid;
+
+    bool pid_active;
+    float pid_setpoint_c;
+    float pid_p;
+    float pid_i;
+    float pid_d;
+    float pid_ff;
+};
+
+/**
+ * Boot milestones, exported as time since boot.
+ */
+enum app_metrics_boot_stage
+{
+    APP_METRICS_BOOT_SAFE_DUTY,     // Fans initialized and running at fallback duty
+    APP_METRICS_BOOT_SENSORS,       // Sensors discovered and configured
+    APP_METRICS_BOOT_FIRST_CONTROL, // First control decision, from first conversion
+    APP_METRICS_BOOT_WIFI,          // WiFi initialized
+    APP_METRICS_BOOT_RAINMAKER,     // RainMaker node and params ready
+    APP_METRICS_BOOT_READY,         // Setup finished, control loop running
+    APP_METRICS_BOOT_STAGE_COUNT,
+};
+
+/**
+ * Timed stages of acquisition, control and export, exported as histograms.
+ */
+enum app_metrics_stage
+{
+    APP_METRICS_STAGE_CONVERT,     // Starting conversion on all buses
+    APP_METRICS_STAGE_CONVERSION,  // Conversion start to collection of its readings
+    APP_METRICS_STAGE_SENSOR_READ, // Single sensor read, including retries
+    APP_METRICS_STAGE_ACQUISITION, // Whole cycle of the sensors task
+    APP_METRICS_STAGE_CONTROL,     // Whole cycle of the control task, including PWM writes
+    APP_METRICS_STAGE_PWM,         // Single duty write
+    APP_METRICS_STAGE_HTTP,        // Rendering of /metrics
+    APP_METRICS_STAGE_COUNT,
+};
+
+enum app_metrics_counter
+{
+    APP_METRICS_CONTROL_DEADLINE_MISSES, // Control cycle started later than its deadline
+    APP_METRICS_SENSOR_OVERRUNS,         // Sensors cycle took longer than the loop interval
+    APP_METRICS_PUSH_DROPS,              // Pushed samples dropped while collector was unreachable
+    APP_METRICS_COUNTER_COUNT,
+};
+
+/**
+ * Immutable state of the controller, as published by the control loop.
+ */
+struct app_metrics_snapshot
+{
+    int64_t timestamp;
+    char hardware[APP_METRICS_HARDWARE_NAME_LEN];
+    size_t sensor_count;
+    uint32_t conversion_ms;
+    struct app_metrics_sensor sensors[DS18B20_GROUP_MAX_SIZE];
+    size_t fan_count;
+    struct app_metrics_fan fans[APP_ZONE_MAX_COUNT];
+};
+
+/**
+ * Returns buffer for next snapshot, to be filled by the control loop. Must be followed by app_metrics_publish().
+ * Only one writer is supported.
+ *
+ * @return Buffer, or NULL if it is still being read by a slow reader, snapshot should be skipped then.
+ */
+struct app_metrics_snapshot *app_metrics_begin();
+
+/**
+ * Atomically publishes snapshot returned by app_metrics_begin().
+ */
+void app_metrics_publish();
+
+/**
+ * Records time of boot stage, only first call for each stage counts. Safe to call from any task.
+ */
+void app_metrics_boot_stage(enum app_metrics_boot_stage stage);
+
+/**
+ * Records duration of a stage into its histogram. Lock-free and cheap, safe to call from any task.
+ */
+void app_metrics_observe(enum app_metrics_stage stage, int64_t duration_us);
+
+/**
+ * Increments counter. Safe to call from any task.
+ */
+void app_metrics_count(enum app_metrics_counter counter);
+
+/**
+ * Adds to counter. Safe to call from any task.
+ */
+void app_metrics_add(enum app_metrics_counter counter, uint32_t n);
+
+/**
+ * Prometheus metrics handler, streams latest published snapshot.
+ */
+esp_err_t app_metrics_http_handler(httpd_req_t *r);
+
+#ifdef __cplusplus
+}
+#endif
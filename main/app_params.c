@@ -0,0 +1,70 @@
+#include "app_params.h"
+#include <stdint.h>
+
+#define APP_PARAMS_INDEX_BITS 9
+#define APP_PARAMS_INDEX_SIZE (1 << APP_PARAMS_INDEX_BITS) // At least twice the entries, so probes stay short
+
+_Static_assert(APP_PARAMS_MAX <= UINT8_MAX, "params do not fit into index slots");
+_Static_assert(APP_PARAMS_INDEX_SIZE >= 2 * APP_PARAMS_MAX, "params index too small");
+
+struct app_params_entry
+{
+    const esp_rmaker_param_t *param;
+    app_params_handler_t handler;
+    void *ctx;
+};
+
+static struct app_params_entry entries[APP_PARAMS_MAX] = {};
+static size_t entry_count = 0;
+static uint8_t slots[APP_PARAMS_INDEX_SIZE] = {}; // Entry position + 1, 0 is empty slot
+
+static size_t app_params_hash(const esp_rmaker_param_t *param)
+{
+    // Fibonacci hashing, low bits of heap pointers are always zero
+    uint32_t key = (uint32_t)((uintptr_t)param >> 2);
+    return (size_t)((key * 2654435761u) >> (32 - APP_PARAMS_INDEX_BITS));
+}
+
+esp_err_t app_params_register(const esp_rmaker_param_t *param, app_params_handler_t handler, void *ctx)
+{
+    if (param == NULL || handler == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (entry_count >= APP_PARAMS_MAX)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Linear probing
+    size_t slot = app_params_hash(param);
+    while (slots[slot] != 0)
+    {
+        if (entries[slots[slot] - 1].param == param)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        slot = (slot + 1) & (APP_PARAMS_INDEX_SIZE - 1);
+    }
+
+    // Entry is complete before its slot is visible, so params can be added while RainMaker dispatches writes
+    entries[entry_count] = (struct app_params_entry){.param = param, .handler = handler, .ctx = ctx};
+    __atomic_store_n(&slots[slot], (uint8_t)(++entry_count), __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+esp_err_t app_params_dispatch(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val)
+{
+    size_t slot = app_params_hash(param);
+    uint8_t position;
+    while ((position = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE)) != 0)
+    {
+        const struct app_params_entry *entry = &entries[position - 1];
+        if (entry->param == param)
+        {
+            return entry->handler(param, val, entry->ctx);
+        }
+        slot = (slot + 1) & (APP_PARAMS_INDEX_SIZE - 1);
+    }
+    return ESP_ERR_NOT_FOUND;
+}
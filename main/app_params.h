@@ -0,0 +1,45 @@
+#pragma once
+
+#include "app_zone.h"
+#include <ds18b20_group.h>
+#include <esp_err.h>
+#include <esp_rmaker_core.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_PARAMS_PER_SENSOR 3 // Name, offset and curve
+#define APP_PARAMS_PER_ZONE 19  // Including sensor selection, which is only on the first zone
+#define APP_PARAMS_MAX (APP_PARAMS_PER_SENSOR * DS18B20_GROUP_MAX_SIZE + APP_PARAMS_PER_ZONE * APP_ZONE_MAX_COUNT)
+
+/**
+ * Handler of single param write.
+ *
+ * @param param Written param
+ * @param val New value, of the param type
+ * @param ctx Context given on registration
+ * @return ESP_OK on success, error rejects the value.
+ */
+typedef esp_err_t (*app_params_handler_t)(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val, void *ctx);
+
+/**
+ * Registers write handler of the param. Lookup is a hash of the param pointer, so dispatch does not depend
+ * on number of params. Registration must happen from a single task, but can run concurrently with dispatch,
+ * so params added after RainMaker is started are handled too.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM when there is more than APP_PARAMS_MAX params,
+ *         ESP_ERR_INVALID_STATE when param is already registered.
+ */
+esp_err_t app_params_register(const esp_rmaker_param_t *param, app_params_handler_t handler, void *ctx);
+
+/**
+ * Calls handler registered for the param.
+ *
+ * @return Result of the handler, ESP_ERR_NOT_FOUND if param has no handler.
+ */
+esp_err_t app_params_dispatch(const esp_rmaker_param_t *param, const esp_rmaker_param_val_t val);
+
+#ifdef __cplusplus
+}
+#endif
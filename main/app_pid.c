@@ -0,0 +1,63 @@
+#include "app_pid.h"
+#include <assert.h>
+
+// Weight of new sample in slope filter, derivative of quantized readings is noisy
+#define APP_PID_SLOPE_FILTER 0.3f
+
+inline static float clamp(float value, float min, float max)
+{
+    return value < min ? min : (value > max ? max : value);
+}
+
+void app_pid_reset(struct app_pid *pid, float output)
+{
+    assert(pid);
+
+    pid->initialized = false;
+    pid->integral = output;
+    pid->slope = 0;
+    pid->p_term = 0;
+    pid->i_term = output;
+    pid->d_term = 0;
+    pid->ff_term = 0;
+    pid->output = output;
+}
+
+float app_pid_update(struct app_pid *pid, float input_c, float dt_s)
+{
+    assert(pid);
+
+    if (!pid->initialized || dt_s <= 0)
+    {
+        pid->last_input_c = input_c;
+        pid->initialized = true;
+        dt_s = 0;
+    }
+    else
+    {
+        float slope = (input_c - pid->last_input_c) / dt_s;
+        pid->slope += APP_PID_SLOPE_FILTER * (slope - pid->slope);
+        pid->last_input_c = input_c;
+    }
+
+    float error = input_c - pid->setpoint_c;
+
+    pid->p_term = pid->kp * error;
+    pid->d_term = pid->kd * pid->slope;
+    // Anticipate load steps - react to rising temperature before the error builds up
+    pid->ff_term = pid->slope > 0 ? pid->kff * pid->slope : 0;
+
+    // Integrate, unless it would push already saturated output further
+    float unclamped = pid->p_term + pid->integral + pid->d_term + pid->ff_term;
+    bool saturated_high = unclamped >= pid->out_max && error > 0;
+    bool saturated_low = unclamped <= pid->out_min && error < 0;
+    if (!saturated_high && !saturated_low)
+    {
+        pid->integral += pid->ki * error * dt_s;
+    }
+    pid->integral = clamp(pid->integral, pid->out_min, pid->out_max);
+    pid->i_term = pid->integral;
+
+    pid->output = clamp(pid->p_term + pid->i_term + pid->d_term + pid->ff_term, pid->out_min, pid->out_max);
+    return pid->output;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * PID controller for cooling - output rises when temperature is above setpoint.
+ * Output is duty 0..1, gains are in duty per °C (and per second, resp. per °C/s).
+ */
+struct app_pid
+{
+    // Tunings
+    float setpoint_c;
+    float kp;
+    float ki;
+    float kd;
+    float kff; // Feed-forward from rising temperature slope, 0 to disable
+    float out_min;
+    float out_max;
+
+    // State
+    bool initialized;
+    float integral;
+    float last_input_c;
+    float slope; // Filtered dT/dt in °C/s
+
+    // Last computed terms, for diagnostics
+    float p_term;
+    float i_term;
+    float d_term;
+    float ff_term;
+    float output;
+};
+
+/**
+ * Resets state. Integral is preset to given output, so switching to PID does not bump the fan.
+ */
+void app_pid_reset(struct app_pid *pid, float output);
+
+/**
+ * Computes next output.
+ *
+ * Derivative is computed on measurement rather than error, so setpoint changes don't kick the output.
+ * Integral is not accumulated while output is saturated in the same direction (anti-windup).
+ *
+ * @param pid Controller
+ * @param input_c Measured temperature
+ * @param dt_s Time since last update
+ * @return Duty 0..1, within out_min and out_max
+ */
+float app_pid_update(struct app_pid *pid, float input_c, float dt_s);
+
+#ifdef __cplusplus
+}
+#endif
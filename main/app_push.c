@@ -0,0 +1,288 @@
+#include "app_push.h"
+#include "app_metrics.h"
+#include "util/util_append.h"
+#include <ctype.h>
+#include <errno.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const char TAG[] = "app_push";
+
+#define APP_PUSH_HOST CONFIG_APP_PUSH_HOST
+#define APP_PUSH_PORT CONFIG_APP_PUSH_PORT
+#define APP_PUSH_FORMAT_STATSD CONFIG_APP_PUSH_FORMAT_STATSD
+#define APP_PUSH_BATCH_SIZE CONFIG_APP_PUSH_BATCH_SIZE
+#define APP_PUSH_BATCH_COUNT CONFIG_APP_PUSH_BATCH_COUNT
+#define APP_PUSH_FLUSH_INTERVAL_US (CONFIG_APP_PUSH_FLUSH_INTERVAL * 1000LL)
+#define APP_PUSH_LINE_MAX 192
+#define APP_PUSH_MIN_VALID_TIME 1600000000 // Wall clock before this was not synced yet
+
+#if APP_PUSH_FORMAT_STATSD
+#define APP_PUSH_FORMAT_NAME "statsd"
+#else
+#define APP_PUSH_FORMAT_NAME "influx"
+#endif
+
+_Static_assert(APP_PUSH_LINE_MAX <= APP_PUSH_BATCH_SIZE, "push batch smaller than single line");
+
+// Single datagram, sent as a whole
+struct app_push_batch
+{
+    char data[APP_PUSH_BATCH_SIZE];
+    uint16_t len;
+    uint16_t lines;
+};
+
+// Ring of batches, push_head is the oldest, last one is being filled. Used only from the telemetry task.
+static char push_hardware[APP_METRICS_HARDWARE_NAME_LEN] = {}; // Copy, device name is changed by RainMaker task
+static struct app_push_batch *push_batches = NULL;
+static size_t push_head = 0;
+static size_t push_count = 0;
+static int64_t push_opened_at = 0; // esp_timer_get_time() of first sample in the last batch
+
+static struct sockaddr_in push_addr = {};
+static int push_socket = -1;
+static int64_t push_connected_at = 0;
+static bool push_failing = false;
+
+esp_err_t app_push_init()
+{
+    if (strlen(APP_PUSH_HOST) == 0)
+    {
+        ESP_LOGI(TAG, "push disabled, no address configured");
+        return ESP_OK;
+    }
+
+    // Numeric address only, name lookup would block telemetry for seconds when DNS does not respond
+    push_addr = (struct sockaddr_in){.sin_family = AF_INET, .sin_port = htons(APP_PUSH_PORT)};
+    if (inet_pton(AF_INET, APP_PUSH_HOST, &push_addr.sin_addr) != 1)
+    {
+        ESP_LOGE(TAG, "push disabled, %s is not an IPv4 address", APP_PUSH_HOST);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!push_batches)
+    {
+        push_batches = calloc(APP_PUSH_BATCH_COUNT, sizeof(struct app_push_batch));
+        if (!push_batches)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    ESP_LOGI(TAG, "pushing %s to %s:%d in %d batches of %d bytes", APP_PUSH_FORMAT_NAME, APP_PUSH_HOST, APP_PUSH_PORT, APP_PUSH_BATCH_COUNT, APP_PUSH_BATCH_SIZE);
+    return ESP_OK;
+}
+
+void app_push_set_hardware(const char *hardware)
+{
+    strlcpy(push_hardware, hardware ? hardware : "", sizeof(push_hardware));
+}
+
+static char *app_push_escape(char *p, const char *end, const char *s)
+{
+    for (; p && *s; s++)
+    {
+#if APP_PUSH_FORMAT_STATSD
+        // Name segments, anything else would be parsed as separator
+        p = util_append(p, end, "%c", isalnum((unsigned char)*s) || *s == '_' || *s == '-' ? *s : '_');
+#else
+        // Tag values
+        p = util_append(p, end, *s == ',' || *s == ' ' || *s == '=' ? "\\%c" : "%c", *s);
+#endif
+    }
+    return p;
+}
+
+static char *app_push_value(char *p, const char *end, float value, bool integer)
+{
+    return integer ? util_append(p, end, "%ld", lroundf(value)) : util_append(p, end, "%.3f", value);
+}
+
+static char *app_push_format(char *p, const char *end, const char *name, const char *tag_key, const char *tag_value, float value, bool integer)
+{
+#if APP_PUSH_FORMAT_STATSD
+    // hardware.name.tag:value|g, negative gauge would be taken as decrement, so it is reset to 0 first
+    char *series = p;
+    p = app_push_escape(p, end, push_hardware);
+    p = util_append(p, end, ".%s.", name);
+    p = app_push_escape(p, end, tag_value);
+    char *series_end = p;
+    if (p && value < 0)
+    {
+        p = util_append(p, end, ":0|g\n%.*s", (int)(series_end - series), series);
+    }
+    p = util_append(p, end, ":");
+    p = app_push_value(p, end, value, integer);
+    p = util_append(p, end, "|g\n");
+    (void)tag_key;
+#else
+    // name,hardware=X,key=value value=1.000 timestamp, timestamp only when wall clock is known,
+    // otherwise collector uses time of arrival
+    p = util_append(p, end, "%s", name);
+    if (push_hardware[0])
+    {
+        p = util_append(p, end, ",hardware=");
+        p = app_push_escape(p, end, push_hardware);
+    }
+    if (tag_value[0])
+    {
+        p = util_append(p, end, ",%s=", tag_key);
+        p = app_push_escape(p, end, tag_value);
+    }
+    p = util_append(p, end, " value=");
+    p = app_push_value(p, end, value, integer);
+    if (integer)
+    {
+        p = util_append(p, end, "i");
+    }
+    struct timeval tv = {};
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec >= APP_PUSH_MIN_VALID_TIME)
+    {
+        p = util_append(p, end, " %lld", (long long)tv.tv_sec * 1000000000LL + (long long)tv.tv_usec * 1000LL);
+    }
+    p = util_append(p, end, "\n");
+#endif
+    return p;
+}
+
+void app_push_gauge(const char *name, const char *tag_key, const char *tag_value, float value, bool integer)
+{
+    if (!push_batches || name == NULL || tag_key == NULL || tag_value == NULL)
+    {
+        return;
+    }
+
+    char line[APP_PUSH_LINE_MAX];
+    char *p = app_push_format(line, line + sizeof(line), name, tag_key, tag_value, value, integer);
+    if (!p)
+    {
+        ESP_LOGD(TAG, "sample %s of %s too long", name, tag_value);
+        return;
+    }
+    size_t len = p - line;
+
+    struct app_push_batch *batch = push_count > 0 ? &push_batches[(push_head + push_count - 1) % APP_PUSH_BATCH_COUNT] : NULL;
+    if (!batch || batch->len + len > APP_PUSH_BATCH_SIZE)
+    {
+        if (push_count == APP_PUSH_BATCH_COUNT)
+        {
+            // Collector is unreachable, oldest samples make room, so memory stays bounded
+            app_metrics_add(APP_METRICS_PUSH_DROPS, push_batches[push_head].lines);
+            push_head = (push_head + 1) % APP_PUSH_BATCH_COUNT;
+            push_count--;
+        }
+        batch = &push_batches[(push_head + push_count) % APP_PUSH_BATCH_COUNT];
+        batch->len = 0;
+        batch->lines = 0;
+        push_count++;
+        push_opened_at = esp_timer_get_time();
+    }
+
+    memcpy(batch->data + batch->len, line, len);
+    batch->len += len;
+    batch->lines++;
+}
+
+static esp_err_t app_push_connect()
+{
+    if (push_socket >= 0)
+    {
+        return ESP_OK;
+    }
+
+    // Socket is opened again after every failure, but at most once per flush interval
+    int64_t now = esp_timer_get_time();
+    if (push_connected_at > 0 && now - push_connected_at < APP_PUSH_FLUSH_INTERVAL_US)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    push_connected_at = now;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd >= 0 && connect(fd, (const struct sockaddr *)&push_addr, sizeof(push_addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+    {
+        ESP_LOGW(TAG, "failed to open socket: %d", errno);
+        return ESP_FAIL;
+    }
+
+    push_socket = fd;
+    return ESP_OK;
+}
+
+static esp_err_t app_push_send(const struct app_push_batch *batch)
+{
+    esp_err_t err = app_push_connect();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    if (send(push_socket, batch->data, batch->len, MSG_DONTWAIT) < 0)
+    {
+        int send_errno = errno;
+        if (!push_failing)
+        {
+            ESP_LOGW(TAG, "failed to send %u samples: %d", (unsigned int)batch->lines, send_errno);
+            push_failing = true;
+        }
+        if (send_errno != EAGAIN && send_errno != EWOULDBLOCK && send_errno != ENOMEM)
+        {
+            // Network went away, socket is opened again once it is back
+            close(push_socket);
+            push_socket = -1;
+        }
+        return ESP_FAIL;
+    }
+
+    if (push_failing)
+    {
+        ESP_LOGI(TAG, "sending again");
+        push_failing = false;
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_push_flush()
+{
+    if (!push_batches)
+    {
+        return ESP_OK;
+    }
+
+    int64_t now = esp_timer_get_time();
+    while (push_count > 0)
+    {
+        // Last batch is still being filled, until it is full or old enough
+        struct app_push_batch *batch = &push_batches[push_head];
+        if (push_count == 1 && now - push_opened_at < APP_PUSH_FLUSH_INTERVAL_US)
+        {
+            break;
+        }
+
+        esp_err_t err = app_push_send(batch);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        ESP_LOGD(TAG, "sent %u samples", (unsigned int)batch->lines);
+        push_head = (push_head + 1) % APP_PUSH_BATCH_COUNT;
+        push_count--;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <esp_err.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initializes push of samples to UDP collector, in InfluxDB line protocol or StatsD format, as configured.
+ * Does nothing when no collector address is configured, other functions are then no-op.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG when configured address is not numeric IPv4,
+ *         ESP_ERR_NO_MEM when batches could not be allocated.
+ */
+esp_err_t app_push_init();
+
+/**
+ * Sets hardware name added to following samples, it is copied, so it can change anytime after this returns.
+ * Must be called from the same task as app_push_gauge().
+ *
+ * @param hardware Hardware name
+ */
+void app_push_set_hardware(const char *hardware);
+
+/**
+ * Formats single gauge sample into current batch, without any allocation. When all batches are full,
+ * because collector is unreachable, the oldest batch is dropped.
+ *
+ * @param name Metric name, e.g. "esp_celsius"
+ * @param tag_key Name of tag identifying the series, e.g. "address"
+ * @param tag_value Value of the tag
+ * @param value Sample value
+ * @param integer Whether value is sent as integer
+ */
+void app_push_gauge(const char *name, const char *tag_key, const char *tag_value, float value, bool integer);
+
+/**
+ * Sends full batches, and the partial one once flush interval expired since its first sample.
+ * Must be called from the same task as app_push_gauge(), never blocks on the network.
+ *
+ * @return ESP_OK on success, or when there was nothing to send, error of the send otherwise,
+ *         unsent batches are retried on next call then.
+ */
+esp_err_t app_push_flush();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,120 @@
+#include "app_report.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <math.h>
+#include <stdatomic.h>
+
+static const char TAG[] = "app_report";
+
+#define APP_REPORT_MIN_INTERVAL_US (CONFIG_APP_REPORT_MIN_INTERVAL * 1000000LL)
+#define APP_REPORT_MAX_INTERVAL_US (CONFIG_APP_REPORT_MAX_INTERVAL * 1000000LL)
+
+struct app_report_entry
+{
+    const esp_rmaker_param_t *param;
+    bool integer;
+    float deadband;
+
+    bool has_value;
+    float value;
+    bool reported;
+    float reported_value;
+    int64_t reported_at;
+};
+
+static struct app_report_entry entries[APP_REPORT_MAX] = {};
+static atomic_size_t entry_count = 0;
+static int64_t last_flush = 0;
+
+esp_err_t app_report_add(const esp_rmaker_param_t *param, bool integer, float deadband, size_t *id)
+{
+    if (id == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *id = APP_REPORT_NONE;
+    if (param == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t count = atomic_load_explicit(&entry_count, memory_order_relaxed);
+    if (count >= APP_REPORT_MAX)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Entry is complete before it is visible to flush
+    entries[count] = (struct app_report_entry){.param = param, .integer = integer, .deadband = deadband};
+    atomic_store_explicit(&entry_count, count + 1, memory_order_release);
+    *id = count;
+    return ESP_OK;
+}
+
+void app_report_set(size_t id, float value)
+{
+    if (id < atomic_load_explicit(&entry_count, memory_order_acquire))
+    {
+        entries[id].value = value;
+        entries[id].has_value = true;
+    }
+}
+
+static esp_rmaker_param_val_t app_report_val(const struct app_report_entry *entry)
+{
+    return entry->integer ? esp_rmaker_int((int)lroundf(entry->value)) : esp_rmaker_float(entry->value);
+}
+
+esp_err_t app_report_flush()
+{
+    int64_t now = esp_timer_get_time();
+    if (last_flush > 0 && now - last_flush < APP_REPORT_MIN_INTERVAL_US)
+    {
+        return ESP_OK;
+    }
+    last_flush = now;
+
+    size_t count = atomic_load_explicit(&entry_count, memory_order_acquire);
+    size_t batch[APP_REPORT_MAX];
+    size_t batch_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct app_report_entry *entry = &entries[i];
+        if (!entry->has_value)
+        {
+            continue;
+        }
+        if (!entry->reported || fabsf(entry->value - entry->reported_value) >= entry->deadband || now - entry->reported_at >= APP_REPORT_MAX_INTERVAL_US)
+        {
+            batch[batch_count++] = i;
+        }
+    }
+    if (batch_count == 0)
+    {
+        return ESP_OK;
+    }
+
+    // Updated params are only marked as changed, the final report sends all of them in one message
+    for (size_t k = 0; k < batch_count - 1; k++)
+    {
+        const struct app_report_entry *entry = &entries[batch[k]];
+        esp_rmaker_param_update(entry->param, app_report_val(entry));
+    }
+    const struct app_report_entry *last = &entries[batch[batch_count - 1]];
+    esp_err_t err = esp_rmaker_param_update_and_report(last->param, app_report_val(last));
+    if (err != ESP_OK)
+    {
+        ESP_LOGD(TAG, "failed to report %u values: %d %s", (unsigned int)batch_count, err, esp_err_to_name(err));
+        return err;
+    }
+
+    for (size_t k = 0; k < batch_count; k++)
+    {
+        struct app_report_entry *entry = &entries[batch[k]];
+        entry->reported = true;
+        entry->reported_value = entry->value;
+        entry->reported_at = now;
+    }
+    ESP_LOGD(TAG, "reported %u values", (unsigned int)batch_count);
+    return ESP_OK;
+}
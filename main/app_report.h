@@ -0,0 +1,47 @@
+#pragma once
+
+#include "app_zone.h"
+#include <ds18b20_group.h>
+#include <esp_err.h>
+#include <esp_rmaker_core.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_REPORT_MAX (DS18B20_GROUP_MAX_SIZE + 2 * APP_ZONE_MAX_COUNT)
+#define APP_REPORT_NONE SIZE_MAX // Id of param that is not registered, ignored by app_report_set()
+
+/**
+ * Registers read-only param with measured value. It is reported only when the value moves by at least deadband
+ * since last report, or when max report interval expires. Registration must happen from a single task,
+ * but can run concurrently with the other functions.
+ *
+ * @param param Param, of int or float type
+ * @param integer Whether param is int, otherwise float
+ * @param deadband Minimal change to report
+ * @param id Set to id of the param, for app_report_set(), APP_REPORT_NONE on failure
+ * @return ESP_OK on success, ESP_ERR_NO_MEM when there is more than APP_REPORT_MAX params.
+ */
+esp_err_t app_report_add(const esp_rmaker_param_t *param, bool integer, float deadband, size_t *id);
+
+/**
+ * Sets current value, nothing is sent until app_report_flush().
+ */
+void app_report_set(size_t id, float value);
+
+/**
+ * Sends all values that need reporting as a single batch, at most once per min report interval.
+ * Must be called from the same task as app_report_set().
+ *
+ * @return ESP_OK on success, or when there was nothing to report, error of the report otherwise,
+ *         values are retried on next call then.
+ */
+esp_err_t app_report_flush();
+
+#ifdef __cplusplus
+}
+#endif
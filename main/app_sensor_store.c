@@ -0,0 +1,177 @@
+#include "app_sensor_store.h"
+#include "app_config.h"
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <nvs.h>
+#include <stddef.h>
+#include <string.h>
+
+static const char TAG[] = "app_sensor_store";
+
+#define APP_SENSOR_STORE_KEY "config"
+
+struct app_sensor_store_header
+{
+    uint32_t crc;         // CRC32 of everything after this field
+    uint16_t version;     // Bumped when meaning of existing fields changes
+    uint16_t record_size; // sizeof(struct app_sensor_record) of the writer
+    uint16_t count;
+    uint16_t reserved;
+    uint32_t reserved2;   // Keeps records 8-byte aligned
+};
+
+struct app_sensor_store_blob
+{
+    struct app_sensor_store_header header;
+    struct app_sensor_record records[APP_SENSOR_STORE_MAX_RECORDS];
+};
+
+// Serialized blob, kept in RAM, so put only patches it. Records are ordered by last update, oldest first.
+static struct app_sensor_store_blob store = {};
+static const char *store_nvs_name = NULL;
+
+_Static_assert(offsetof(struct app_sensor_store_blob, records) == sizeof(struct app_sensor_store_header), "records must follow the header");
+
+static uint32_t app_sensor_store_crc(const void *data, size_t len)
+{
+    const uint8_t *start = (const uint8_t *)data + sizeof(uint32_t);
+    return esp_rom_crc32_le(0, start, len - sizeof(uint32_t));
+}
+
+static void app_sensor_store_reset()
+{
+    memset(&store, 0, sizeof(store));
+    store.header.version = APP_SENSOR_STORE_VERSION;
+    store.header.record_size = sizeof(struct app_sensor_record);
+}
+
+esp_err_t app_sensor_store_load(const char *nvs_name)
+{
+    if (nvs_name == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    store_nvs_name = nvs_name;
+    app_sensor_store_reset();
+
+    nvs_handle_t handle = 0;
+    esp_err_t err = nvs_open(nvs_name, NVS_READONLY, &handle);
+    if (err != ESP_OK)
+    {
+        // Namespace does not exist before first write
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+    }
+
+    // Read directly into the store, blob has the same layout
+    size_t len = sizeof(store);
+    err = nvs_get_blob(handle, APP_SENSOR_STORE_KEY, &store, &len);
+    nvs_close(handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        app_sensor_store_reset();
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "failed to read %s: %d %s", APP_SENSOR_STORE_KEY, err, esp_err_to_name(err));
+        app_sensor_store_reset();
+        return err;
+    }
+
+    struct app_sensor_store_header header = store.header;
+    if (len < sizeof(header) || header.crc != app_sensor_store_crc(&store, len))
+    {
+        ESP_LOGE(TAG, "%s has invalid CRC, ignoring it", APP_SENSOR_STORE_KEY);
+        app_sensor_store_reset();
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (header.version != APP_SENSOR_STORE_VERSION || header.record_size == 0 ||
+        len != sizeof(header) + (size_t)header.count * header.record_size)
+    {
+        ESP_LOGE(TAG, "%s has unsupported version %u or size %u", APP_SENSOR_STORE_KEY, header.version, (unsigned int)len);
+        app_sensor_store_reset();
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    // Records of other sizes are converted in place, so fields can be appended without migration
+    size_t count = header.count < APP_SENSOR_STORE_MAX_RECORDS ? header.count : APP_SENSOR_STORE_MAX_RECORDS;
+    size_t size = sizeof(struct app_sensor_record);
+    uint8_t *base = (uint8_t *)store.records;
+    if (header.record_size < size)
+    {
+        for (size_t i = count; i-- > 0;)
+        {
+            memmove(base + i * size, base + i * header.record_size, header.record_size);
+            memset(base + i * size + header.record_size, 0, size - header.record_size);
+        }
+    }
+    else if (header.record_size > size)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            memmove(base + i * size, base + i * header.record_size, size);
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        store.records[i].name[sizeof(store.records[i].name) - 1] = '\0';
+        store.records[i].curve_points[sizeof(store.records[i].curve_points) - 1] = '\0';
+    }
+    store.header.version = APP_SENSOR_STORE_VERSION;
+    store.header.record_size = size;
+    store.header.count = count;
+
+    ESP_LOGI(TAG, "loaded %u sensors", (unsigned int)count);
+    return ESP_OK;
+}
+
+const struct app_sensor_record *app_sensor_store_get(uint64_t rom_code)
+{
+    for (size_t i = 0; i < store.header.count; i++)
+    {
+        if (store.records[i].rom_code == rom_code)
+        {
+            return &store.records[i];
+        }
+    }
+    return NULL;
+}
+
+const struct app_sensor_record *app_sensor_store_records(size_t *count)
+{
+    *count = store.header.count;
+    return store.records;
+}
+
+esp_err_t app_sensor_store_put(const struct app_sensor_record *record)
+{
+    if (record == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (store_nvs_name == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Remove existing one, or oldest one if full, and append, so records stay ordered by update
+    size_t i = 0;
+    while (i < store.header.count && store.records[i].rom_code != record->rom_code)
+    {
+        i++;
+    }
+    if (i == APP_SENSOR_STORE_MAX_RECORDS)
+    {
+        i = 0;
+    }
+    if (i < store.header.count)
+    {
+        memmove(&store.records[i], &store.records[i + 1], (store.header.count - i - 1) * sizeof(*store.records));
+        store.header.count--;
+    }
+    store.records[store.header.count++] = *record;
+
+    size_t len = sizeof(store.header) + store.header.count * sizeof(struct app_sensor_record);
+    store.header.crc = app_sensor_store_crc(&store, len);
+    return app_config_set_blob(APP_SENSOR_STORE_KEY, &store, len);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <ds18b20_group.h>
+#include <esp_err.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_SENSOR_STORE_VERSION 1
+#define APP_SENSOR_STORE_MAX_RECORDS (2 * DS18B20_GROUP_MAX_SIZE) // Room for sensors that are disconnected at the moment
+#define APP_SENSOR_STORE_NAME_LEN 33
+#define APP_SENSOR_STORE_CURVE_LEN 100
+
+/**
+ * Persistent config of single sensor, identified by its full ROM code.
+ *
+ * New fields must be appended only, records of older firmware are zero-filled past their size.
+ */
+struct app_sensor_record
+{
+    uint64_t rom_code;
+    float offset_c;
+    char name[APP_SENSOR_STORE_NAME_LEN];
+    char curve_points[APP_SENSOR_STORE_CURVE_LEN]; // Empty means zone curve
+    uint8_t bus;                                   // Bus the sensor was last seen on
+    uint8_t slot;                                  // Index in the group + 1, 0 when sensor is not connected
+};
+
+/**
+ * Loads config of all sensors, stored as a single versioned and CRC-checked blob, in one NVS read.
+ *
+ * @param nvs_name NVS namespace, must be valid for the program lifetime, also used by app_config
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if nothing is stored yet, ESP_ERR_INVALID_CRC or ESP_ERR_INVALID_VERSION
+ *         if stored data are not usable. Store is empty and usable in all these cases.
+ */
+esp_err_t app_sensor_store_load(const char *nvs_name);
+
+/**
+ * Finds config of sensor.
+ *
+ * @return Stored record or NULL when sensor has none. Valid until next app_sensor_store_put().
+ */
+const struct app_sensor_record *app_sensor_store_get(uint64_t rom_code);
+
+/**
+ * Returns all stored records, in order of last update.
+ *
+ * @param count Number of records
+ * @return Records, valid until next app_sensor_store_put().
+ */
+const struct app_sensor_record *app_sensor_store_records(size_t *count);
+
+/**
+ * Inserts or replaces config of sensor and queues the blob via app_config. When the store is full,
+ * record not updated for the longest time is dropped.
+ *
+ * Not thread-safe, callers must serialize all store calls and use of returned records.
+ */
+esp_err_t app_sensor_store_put(const struct app_sensor_record *record);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,119 @@
+#include "app_stream.h"
+#include <esp_log.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char TAG[] = "app_stream";
+
+static const char STREAM_HEADERS[] = "HTTP/1.1 200 OK\r\n"
+                                     "Content-Type: text/event-stream\r\n"
+                                     "Cache-Control: no-cache\r\n"
+                                     "Connection: keep-alive\r\n\r\n";
+
+// Clients are changed only from the HTTP server task, by the handler, send work and close callback
+static httpd_handle_t stream_server = NULL;
+static int stream_clients[APP_STREAM_MAX_CLIENTS] = {};
+static atomic_size_t stream_client_count = 0;
+
+// Single record in flight, owned by the writer until queued, then by the HTTP server task until sent
+static char stream_record[APP_STREAM_RECORD_SIZE] = {};
+static size_t stream_record_len = 0;
+static atomic_bool stream_record_busy = false;
+
+static void app_stream_remove(int fd)
+{
+    size_t count = atomic_load(&stream_client_count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (stream_clients[i] == fd)
+        {
+            stream_clients[i] = stream_clients[count - 1];
+            atomic_store(&stream_client_count, count - 1);
+            ESP_LOGI(TAG, "client %d disconnected", fd);
+            return;
+        }
+    }
+}
+
+static void app_stream_send(__unused void *arg)
+{
+    // Backwards, so removed client is replaced by already processed one
+    size_t count = atomic_load(&stream_client_count);
+    for (size_t i = count; i-- > 0;)
+    {
+        int fd = stream_clients[i];
+        int sent = httpd_socket_send(stream_server, fd, stream_record, stream_record_len, MSG_DONTWAIT);
+        if (sent != (int)stream_record_len)
+        {
+            // Full send buffer means the client does not keep up, partial record also breaks the stream
+            ESP_LOGW(TAG, "dropping slow client %d", fd);
+            app_stream_remove(fd);
+            httpd_sess_trigger_close(stream_server, fd);
+        }
+    }
+    atomic_store(&stream_record_busy, false);
+}
+
+char *app_stream_begin(size_t *size)
+{
+    if (atomic_load(&stream_client_count) == 0)
+    {
+        return NULL;
+    }
+
+    bool busy = false;
+    if (!atomic_compare_exchange_strong(&stream_record_busy, &busy, true))
+    {
+        ESP_LOGD(TAG, "record skipped, previous one is still being sent");
+        return NULL;
+    }
+    *size = sizeof(stream_record);
+    return stream_record;
+}
+
+void app_stream_publish(size_t len)
+{
+    stream_record_len = len;
+    if (len == 0 || httpd_queue_work(stream_server, app_stream_send, NULL) != ESP_OK)
+    {
+        atomic_store(&stream_record_busy, false);
+    }
+}
+
+esp_err_t app_stream_http_handler(httpd_req_t *r)
+{
+    int fd = httpd_req_to_sockfd(r);
+    size_t count = atomic_load(&stream_client_count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (stream_clients[i] == fd)
+        {
+            // Already streaming on this connection
+            return ESP_OK;
+        }
+    }
+    if (count >= APP_STREAM_MAX_CLIENTS)
+    {
+        httpd_resp_set_status(r, "503 Service Unavailable");
+        return httpd_resp_send(r, NULL, 0);
+    }
+
+    // Headers only, without content length, connection then stays open for records
+    if (httpd_send(r, STREAM_HEADERS, sizeof(STREAM_HEADERS) - 1) != sizeof(STREAM_HEADERS) - 1)
+    {
+        return ESP_FAIL;
+    }
+    stream_server = r->handle;
+    stream_clients[count] = fd;
+    atomic_store(&stream_client_count, count + 1);
+    ESP_LOGI(TAG, "client %d connected", fd);
+    return ESP_OK;
+}
+
+void app_stream_close_fn(__unused httpd_handle_t hd, int sockfd)
+{
+    app_stream_remove(sockfd);
+    close(sockfd);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_STREAM_MAX_CLIENTS 4
+#define APP_STREAM_RECORD_SIZE 1024
+
+/**
+ * Returns buffer for next record, to be filled with complete Server-Sent Events message and passed
+ * to app_stream_publish(). Never blocks.
+ *
+ * @param size Set to size of the buffer
+ * @return Buffer, or NULL if there are no clients, or previous record was not sent yet, record should be skipped then.
+ */
+char *app_stream_begin(size_t *size);
+
+/**
+ * Sends record from app_stream_begin() to all clients, from the HTTP server task. Clients that cannot take
+ * the whole record right away are disconnected, so nothing is ever buffered for them.
+ *
+ * @param len Length of the record, 0 cancels it
+ */
+void app_stream_publish(size_t len);
+
+/**
+ * Server-Sent Events handler, connection stays open and receives every published record.
+ */
+esp_err_t app_stream_http_handler(httpd_req_t *r);
+
+/**
+ * Session close callback, must be set as close_fn of the HTTP server, so closed sockets are never written to.
+ */
+void app_stream_close_fn(httpd_handle_t hd, int sockfd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,117 @@
+#include "app_tach.h"
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+static const char TAG[] = "app_tach";
+
+#define HW_RPM_TIMEOUT CONFIG_HW_RPM_TIMEOUT
+#define APP_TACH_RING_MASK (APP_TACH_RING_SIZE - 1)
+#define APP_TACH_MIN_PERIOD_US 1000 // Glitch filter, that is 30000 RPM
+
+static void IRAM_ATTR app_tach_isr(void *arg)
+{
+    struct app_tach *tach = (struct app_tach *)arg;
+    int64_t now = esp_timer_get_time();
+
+    // Single producer, so relaxed load of own counter is enough
+    unsigned int head = atomic_load_explicit(&tach->head, memory_order_relaxed);
+    if (head > 0 && now - tach->edges[(head - 1) & APP_TACH_RING_MASK] < APP_TACH_MIN_PERIOD_US)
+    {
+        return;
+    }
+
+    tach->edges[head & APP_TACH_RING_MASK] = now;
+    atomic_store_explicit(&tach->head, head + 1, memory_order_release);
+}
+
+esp_err_t app_tach_init(struct app_tach *tach, int pin)
+{
+    assert(tach);
+
+    tach->pin = pin;
+    atomic_store(&tach->head, 0);
+
+    // Tachometer output is open collector
+    gpio_config_t cfg = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    esp_err_t err = gpio_config(&cfg);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "gpio_config(%d) failed: %d %s", pin, err, esp_err_to_name(err));
+        return err;
+    }
+
+    // Service is shared, it might have been installed already
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+    {
+        ESP_LOGE(TAG, "gpio_install_isr_service failed: %d %s", err, esp_err_to_name(err));
+        return err;
+    }
+
+    err = gpio_isr_handler_add((gpio_num_t)pin, app_tach_isr, tach);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "gpio_isr_handler_add(%d) failed: %d %s", pin, err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+uint16_t app_tach_rpm(struct app_tach *tach)
+{
+    int64_t last = 0;
+    int64_t first = 0;
+    unsigned int pulses = 0;
+
+    for (;;)
+    {
+        unsigned int head = atomic_load_explicit(&tach->head, memory_order_acquire);
+        if (head < 2)
+        {
+            return 0;
+        }
+
+        // Span one full revolution when possible, so uneven magnet spacing does not matter
+        pulses = head > APP_TACH_PULSES_PER_REV ? APP_TACH_PULSES_PER_REV : 1;
+        last = tach->edges[(head - 1) & APP_TACH_RING_MASK];
+        first = tach->edges[(head - 1 - pulses) & APP_TACH_RING_MASK];
+
+        // ISR could have wrapped the ring while copying, which is practically impossible, but cheap to check
+        if (atomic_load_explicit(&tach->head, memory_order_acquire) - head < APP_TACH_RING_SIZE - APP_TACH_PULSES_PER_REV - 1)
+        {
+            break;
+        }
+    }
+
+    // Stopped fan does not produce any edges
+    int64_t since_last = esp_timer_get_time() - last;
+    if (since_last > HW_RPM_TIMEOUT * 1000LL)
+    {
+        return 0;
+    }
+
+    // Slowing fan - pending pulse is already longer than the measured ones
+    int64_t period = (last - first) / pulses;
+    if (since_last > period)
+    {
+        period = since_last;
+    }
+    if (period <= 0)
+    {
+        return 0;
+    }
+
+    return (uint16_t)(60000000LL / (period * APP_TACH_PULSES_PER_REV));
+}
+
+uint32_t app_tach_count(struct app_tach *tach)
+{
+    return atomic_load_explicit(&tach->head, memory_order_relaxed);
+}
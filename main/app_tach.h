@@ -0,0 +1,44 @@
+#pragma once
+
+#include <esp_err.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_TACH_RING_SIZE 16 // Must be power of 2
+#define APP_TACH_PULSES_PER_REV 2
+
+/**
+ * Fan tachometer measuring pulse period. Edges are timestamped in the GPIO ISR into a lock-free ring,
+ * RPM is computed only when asked, from the last full revolution.
+ */
+struct app_tach
+{
+    int pin;
+    atomic_uint head; // Number of edges recorded, written only by the ISR
+    int64_t edges[APP_TACH_RING_SIZE];
+};
+
+/**
+ * Configures the pin and starts timestamping its falling edges.
+ */
+esp_err_t app_tach_init(struct app_tach *tach, int pin);
+
+/**
+ * Computes RPM from the newest edges. Safe to call from any task, while the ISR is running.
+ *
+ * @return RPM, 0 if the fan is stopped or no edge was seen within CONFIG_HW_RPM_TIMEOUT.
+ */
+uint16_t app_tach_rpm(struct app_tach *tach);
+
+/**
+ * Total number of pulses since init.
+ */
+uint32_t app_tach_count(struct app_tach *tach);
+
+#ifdef __cplusplus
+}
+#endif
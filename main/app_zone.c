@@ -0,0 +1,491 @@
+#include "app_zone.h"
+#include "app_metrics.h"
+#include <esp_log.h>
+#include <math.h>
+#include <pc_fan_control.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char TAG[] = "app_zone";
+
+#define HW_PWM_INVERTED CONFIG_HW_PWM_INVERTED
+#define HW_PWM_TIMER LEDC_TIMER_0
+#define HW_RPM_PERIOD CONFIG_HW_RPM_PERIOD
+#define HW_RPM_SAMPLES CONFIG_HW_RPM_SAMPLES
+#define HW_RPM_SAMPLING_INTERVAL CONFIG_HW_RPM_SAMPLING_INTERVAL
+#define APP_ZONE_RPM_TRIM_GAIN 0.2f // Duty per second, at error of max RPM
+#define APP_ZONE_RPM_TRIM_MAX 0.2f  // Calibration should be close, trim just compensates drift
+
+static void app_zone_calibration_key(const struct app_zone *zone, char *key, size_t len)
+{
+    snprintf(key, len, "cal%u", (unsigned int)zone->index);
+}
+
+esp_err_t app_zone_init(struct app_zone *zone, size_t index, const struct app_zone_hw *hw)
+{
+    assert(zone);
+    assert(hw);
+
+    // Defaults
+    *zone = (struct app_zone){
+        .index = index,
+        .hw = *hw,
+        .low_duty_percent = 0.5f,
+        .high_duty_percent = 0.9f,
+        .low_temperature_threshold = 25.0f,
+        .high_temperature_threshold = 35.0f,
+        .curve_hysteresis_c = 0.2f,
+        .curve_slew_rate = 0.1f,
+        .mode = APP_ZONE_MODE_CURVE,
+        .active_mode = APP_ZONE_MODE_CURVE,
+        .pid_setpoint_c = 30.0f,
+        .pid_kp = 0.1f,
+        .pid_ki = 0.005f,
+        .pid_kd = 0.5f,
+        .pid_kff = 1.0f,
+        .duty_percent = 0.9f,
+        .fusion = APP_FUSION_MAX,
+        .lock = portMUX_INITIALIZER_UNLOCKED,
+        .sources = {{.index = 0, .weight = 1.0f}},
+        .source_count = 1,
+    };
+    if (index == 0)
+    {
+        strlcpy(zone->name, "Fan", sizeof(zone->name));
+    }
+    else
+    {
+        snprintf(zone->name, sizeof(zone->name), "Fan %u", (unsigned int)(index + 1));
+    }
+
+    app_health_init(&zone->health);
+    app_curve_init(&zone->curve);
+    for (size_t i = 0; i < APP_FUSION_MAX_SOURCES; i++)
+    {
+        app_curve_init(&zone->source_curves[i]);
+    }
+    app_zone_set_hysteresis(zone, zone->curve_hysteresis_c);
+    app_zone_set_slew_rate(zone, zone->curve_slew_rate);
+    app_zone_update_curve(zone);
+
+    char cal_key[8] = {};
+    app_zone_calibration_key(zone, cal_key, sizeof(cal_key));
+    if (app_calibration_load(&zone->calibration, cal_key) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "%s calibrated, max %u rpm, stall duty %u%%", zone->name, zone->calibration.rpm[APP_CALIBRATION_POINTS - 1], zone->calibration.stall_duty);
+    }
+
+    // All zones share single timer, so they run at the same frequency
+    esp_err_t err = pc_fan_control_init((gpio_num_t)hw->pwm_pin, HW_PWM_TIMER, hw->pwm_channel);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "failed to init %s control: %d %s", zone->name, err, esp_err_to_name(err));
+        return err;
+    }
+    app_zone_set_duty(zone, zone->duty_percent);
+
+    if (hw->rpm_pin < 0)
+    {
+        // No tachometer
+        return ESP_OK;
+    }
+
+#if HW_RPM_PERIOD
+    // Edges are timestamped, no periodic sampling needed
+    err = app_tach_init(&zone->tach, hw->rpm_pin);
+#else
+    struct pc_fan_rpm_config rpm_cfg = {
+        .pin = (gpio_num_t)hw->rpm_pin,
+        .unit = hw->rpm_unit,
+    };
+    pc_fan_rpm_handle_ptr rpm_handle = NULL;
+    err = pc_fan_rpm_create(&rpm_cfg, &rpm_handle);
+    if (err == ESP_OK)
+    {
+        err = pc_fan_rpm_sampling_create(HW_RPM_SAMPLES, rpm_handle, &zone->rpm);
+    }
+    if (err == ESP_OK)
+    {
+        err = pc_fan_rpm_sampling_timer_create(zone->rpm, &zone->rpm_timer);
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_timer_start_periodic(zone->rpm_timer, HW_RPM_SAMPLING_INTERVAL * 1000); // ms to us
+    }
+#endif
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "failed to init %s rpm: %d %s", zone->name, err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t app_zone_update_curve(struct app_zone *zone)
+{
+    struct app_curve_point points[APP_CURVE_MAX_POINTS] = {};
+    size_t count = 0;
+
+    if (zone->curve_points[0] != '\0')
+    {
+        esp_err_t err = app_curve_parse(zone->curve_points, points, &count);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "invalid %s curve '%s'", zone->name, zone->curve_points);
+            return err;
+        }
+    }
+    else
+    {
+        // Legacy linear map, clamped to range
+        points[0] = (struct app_curve_point){.temperature_c = zone->low_temperature_threshold, .duty_percent = zone->low_duty_percent};
+        points[1] = (struct app_curve_point){.temperature_c = zone->high_temperature_threshold, .duty_percent = zone->high_duty_percent};
+        count = 2;
+    }
+
+    esp_err_t err = app_curve_set_points(&zone->curve, points, count);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "failed to set %s curve: %d %s", zone->name, err, esp_err_to_name(err));
+        return err;
+    }
+
+    // Sources without own curve follow the zone curve
+    for (size_t i = 0; i < zone->source_count; i++)
+    {
+        if (!zone->source_curve_own[i])
+        {
+            app_curve_set_points(&zone->source_curves[i], points, count);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_zone_set_sources(struct app_zone *zone, const struct app_fusion_source *sources, size_t count, const char *const *curves)
+{
+    if (sources == NULL || count < 1 || count > APP_FUSION_MAX_SOURCES)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Parse everything first, so invalid curve does not leave zone half-updated
+    struct app_curve_point points[APP_FUSION_MAX_SOURCES][APP_CURVE_MAX_POINTS] = {};
+    size_t point_counts[APP_FUSION_MAX_SOURCES] = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        if (curves && curves[i] && curves[i][0] != '\0' && app_curve_parse(curves[i], points[i], &point_counts[i]) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "invalid %s source curve '%s'", zone->name, curves[i]);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        zone->source_curve_own[i] = point_counts[i] > 0;
+        if (zone->source_curve_own[i])
+        {
+            app_curve_set_points(&zone->source_curves[i], points[i], point_counts[i]);
+        }
+        else
+        {
+            app_curve_set_points(&zone->source_curves[i], zone->curve.points, zone->curve.count);
+        }
+    }
+
+    portENTER_CRITICAL(&zone->lock);
+    memcpy(zone->sources, sources, count * sizeof(*sources));
+    zone->source_count = count;
+    portEXIT_CRITICAL(&zone->lock);
+    return ESP_OK;
+}
+
+void app_zone_set_hysteresis(struct app_zone *zone, float hysteresis_c)
+{
+    zone->curve_hysteresis_c = hysteresis_c;
+    app_curve_set_hysteresis(&zone->curve, hysteresis_c);
+    for (size_t i = 0; i < APP_FUSION_MAX_SOURCES; i++)
+    {
+        app_curve_set_hysteresis(&zone->source_curves[i], hysteresis_c);
+    }
+}
+
+void app_zone_set_slew_rate(struct app_zone *zone, float slew_rate)
+{
+    zone->curve_slew_rate = slew_rate;
+    app_curve_set_slew_rate(&zone->curve, slew_rate);
+    for (size_t i = 0; i < APP_FUSION_MAX_SOURCES; i++)
+    {
+        app_curve_set_slew_rate(&zone->source_curves[i], slew_rate);
+    }
+}
+
+size_t app_zone_get_sources(struct app_zone *zone, struct app_fusion_source *sources)
+{
+    portENTER_CRITICAL(&zone->lock);
+    size_t count = zone->source_count;
+    memcpy(sources, zone->sources, count * sizeof(*sources));
+    portEXIT_CRITICAL(&zone->lock);
+    return count;
+}
+
+float app_zone_curve_distance(struct app_zone *zone, size_t sensor_index, float temperature_c)
+{
+    struct app_fusion_source sources[APP_FUSION_MAX_SOURCES];
+    size_t source_count = app_zone_get_sources(zone, sources);
+
+    float distance_c = INFINITY;
+    for (size_t i = 0; i < source_count; i++)
+    {
+        if (sources[i].index == sensor_index)
+        {
+            struct app_curve *curve = zone->fusion == APP_FUSION_CURVE_MAX ? &zone->source_curves[i] : &zone->curve;
+            distance_c = fminf(distance_c, app_curve_distance(curve, temperature_c));
+        }
+    }
+    return distance_c;
+}
+
+void app_zone_set_mode(struct app_zone *zone, enum app_zone_mode mode)
+{
+    portENTER_CRITICAL(&zone->lock);
+    zone->mode = mode;
+    portEXIT_CRITICAL(&zone->lock);
+}
+
+bool app_zone_calibrate(struct app_zone *zone)
+{
+    if (zone->hw.rpm_pin < 0)
+    {
+        ESP_LOGW(TAG, "%s has no tachometer, cannot calibrate", zone->name);
+        return false;
+    }
+    portENTER_CRITICAL(&zone->lock);
+    zone->calibrate = true;
+    portEXIT_CRITICAL(&zone->lock);
+    return true;
+}
+
+static void app_zone_apply_requests(struct app_zone *zone)
+{
+    portENTER_CRITICAL(&zone->lock);
+    enum app_zone_mode mode = zone->mode;
+    bool calibrate = zone->calibrate;
+    zone->calibrate = false;
+    portEXIT_CRITICAL(&zone->lock);
+
+    if (mode == APP_ZONE_MODE_PID && zone->active_mode != APP_ZONE_MODE_PID)
+    {
+        // Bumpless transfer, start from current duty
+        app_pid_reset(&zone->pid, zone->duty_percent);
+    }
+    if (mode == APP_ZONE_MODE_RPM && zone->active_mode != APP_ZONE_MODE_RPM)
+    {
+        zone->rpm_trim = 0;
+    }
+    zone->active_mode = mode;
+
+    if (calibrate)
+    {
+        ESP_LOGI(TAG, "%s calibration started", zone->name);
+        app_calibration_sweep_start(&zone->sweep, esp_timer_get_time());
+    }
+}
+
+static bool app_zone_calibration_update(struct app_zone *zone)
+{
+    if (!zone->sweep.active)
+    {
+        return false;
+    }
+
+    float duty_percent = 1.0f;
+    if (app_calibration_sweep_update(&zone->sweep, app_zone_rpm(zone), esp_timer_get_time(), &duty_percent))
+    {
+        app_zone_set_duty(zone, duty_percent);
+        return true;
+    }
+
+    // Finished, result is stored by telemetry, flash write would stall control
+    zone->calibration = zone->sweep.result;
+    zone->rpm_trim = 0;
+    ESP_LOGI(TAG, "%s calibration finished, max %u rpm, stall duty %u%%", zone->name, zone->calibration.rpm[APP_CALIBRATION_POINTS - 1], zone->calibration.stall_duty);
+    return false;
+}
+
+esp_err_t app_zone_calibration_store(const struct app_zone *zone, const struct app_calibration *calibration)
+{
+    char cal_key[8] = {};
+    app_zone_calibration_key(zone, cal_key, sizeof(cal_key));
+    return app_calibration_store(calibration, cal_key);
+}
+
+static float app_zone_rpm_control(struct app_zone *zone, float fraction, float dt_s)
+{
+    const struct app_calibration *cal = &zone->calibration;
+    float max_rpm = (float)cal->rpm[APP_CALIBRATION_POINTS - 1];
+    zone->rpm_target = (uint16_t)(fraction * max_rpm);
+
+    // Feed-forward from calibration, integral trim compensates dust, voltage and temperature drift
+    float duty_percent = app_calibration_duty(cal, zone->rpm_target);
+    float error = ((float)zone->rpm_target - (float)app_zone_rpm(zone)) / max_rpm;
+    zone->rpm_trim += APP_ZONE_RPM_TRIM_GAIN * error * dt_s;
+    if (zone->rpm_trim > APP_ZONE_RPM_TRIM_MAX)
+    {
+        zone->rpm_trim = APP_ZONE_RPM_TRIM_MAX;
+    }
+    else if (zone->rpm_trim < -APP_ZONE_RPM_TRIM_MAX)
+    {
+        zone->rpm_trim = -APP_ZONE_RPM_TRIM_MAX;
+    }
+    duty_percent += zone->rpm_trim;
+
+    // Never go below the duty where the fan stops
+    float stall_duty = (float)cal->stall_duty / 100.0f;
+    if (duty_percent < stall_duty)
+    {
+        duty_percent = stall_duty;
+    }
+    return duty_percent < 1.0f ? duty_percent : 1.0f;
+}
+
+void app_zone_set_duty(struct app_zone *zone, float duty_percent)
+{
+    // Write only on change
+    if (zone->duty_written && duty_percent == zone->duty_percent)
+    {
+        return;
+    }
+    ESP_LOGI(TAG, "changing %s duty to %0.1f", zone->name, duty_percent * 100.0f);
+
+    // Invert if needed
+    float value = duty_percent;
+#if HW_PWM_INVERTED
+    value = 1.0f - value;
+#endif
+
+    // Change
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = pc_fan_control_set_duty(zone->hw.pwm_channel, value);
+    app_metrics_observe(APP_METRICS_STAGE_PWM, esp_timer_get_time() - start);
+    if (err == ESP_OK)
+    {
+        zone->duty_percent = duty_percent;
+        zone->duty_written = true;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "failed to control %s: %d %s", zone->name, err, esp_err_to_name(err));
+    }
+}
+
+static float app_zone_curve_max(struct app_zone *zone, const struct app_fusion_source *sources, size_t source_count,
+                                const float *values_c, const bool *valid, float dt_s)
+{
+    // Every source through its own curve, hottest relative to its curve wins
+    float duty_percent = 0;
+    for (size_t i = 0; i < source_count; i++)
+    {
+        size_t index = sources[i].index;
+        if (valid[index])
+        {
+            duty_percent = fmaxf(duty_percent, app_curve_update(&zone->source_curves[i], values_c[index], dt_s));
+        }
+    }
+    return duty_percent;
+}
+
+void app_zone_control(struct app_zone *zone, const float *values_c, const bool *valid, float dt_s)
+{
+    app_zone_apply_requests(zone);
+    if (app_zone_calibration_update(zone))
+    {
+        return;
+    }
+
+    // Combine sources, any valid one is enough
+    struct app_fusion_source sources[APP_FUSION_MAX_SOURCES];
+    size_t source_count = app_zone_get_sources(zone, sources);
+    float temperature_c = 0;
+    zone->input_valid = app_fusion_combine(zone->fusion, sources, source_count, values_c, valid, &temperature_c);
+    if (!zone->input_valid)
+    {
+        ESP_LOGW(TAG, "%s has no valid sensor", zone->name);
+        app_zone_set_duty(zone, zone->failsafe ? 1.0f : zone->high_duty_percent);
+        return;
+    }
+    zone->input_c = temperature_c;
+
+    float duty_percent;
+    zone->rpm_target = 0;
+    if (zone->active_mode == APP_ZONE_MODE_PID)
+    {
+        // Closed loop, hold temperature at setpoint within low-high duty range
+        struct app_pid *pid = &zone->pid;
+        pid->setpoint_c = zone->pid_setpoint_c;
+        pid->kp = zone->pid_kp;
+        pid->ki = zone->pid_ki;
+        pid->kd = zone->pid_kd;
+        pid->kff = zone->pid_kff;
+        pid->out_min = zone->low_duty_percent;
+        pid->out_max = zone->high_duty_percent;
+        duty_percent = app_pid_update(pid, temperature_c, dt_s);
+        ESP_LOGD(TAG, "%s pid p=%.3f i=%.3f d=%.3f ff=%.3f", zone->name, pid->p_term, pid->i_term, pid->d_term, pid->ff_term);
+    }
+    else
+    {
+        // Map temperature to duty cycle
+        duty_percent = zone->fusion == APP_FUSION_CURVE_MAX ? app_zone_curve_max(zone, sources, source_count, values_c, valid, dt_s) : app_curve_update(&zone->curve, temperature_c, dt_s);
+
+        if (zone->active_mode == APP_ZONE_MODE_RPM && app_calibration_valid(&zone->calibration))
+        {
+            // Curve gives RPM, inner loop finds the duty, uncalibrated fan uses the curve duty directly
+            duty_percent = app_zone_rpm_control(zone, duty_percent, dt_s);
+        }
+    }
+
+    if (zone->failsafe)
+    {
+        duty_percent = 1.0f;
+    }
+    else if (zone->force_max_duty)
+    {
+        duty_percent = zone->high_duty_percent;
+    }
+    app_zone_set_duty(zone, duty_percent);
+}
+
+void app_zone_fallback(struct app_zone *zone)
+{
+    app_zone_apply_requests(zone);
+    if (app_zone_calibration_update(zone))
+    {
+        return;
+    }
+    app_zone_set_duty(zone, zone->failsafe ? 1.0f : zone->high_duty_percent);
+}
+
+uint16_t app_zone_rpm(struct app_zone *zone)
+{
+    if (zone->hw.rpm_pin < 0)
+    {
+        return 0;
+    }
+#if HW_RPM_PERIOD
+    return app_tach_rpm(&zone->tach);
+#else
+    return zone->rpm ? pc_fan_rpm_sampling_last_rpm(zone->rpm) : 0;
+#endif
+}
+
+uint32_t app_zone_rpm_count(struct app_zone *zone)
+{
+    if (zone->hw.rpm_pin < 0)
+    {
+        return 0;
+    }
+#if HW_RPM_PERIOD
+    return app_tach_count(&zone->tach);
+#else
+    return zone->rpm ? pc_fan_rpm_sampling_last_count(zone->rpm) : 0;
+#endif
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "app_calibration.h"
+#include "app_curve.h"
+#include "app_fusion.h"
+#include "app_health.h"
+#include "app_pid.h"
+#include "app_tach.h"
+#include <driver/ledc.h>
+#include <driver/pcnt.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <pc_fan_rpm.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_ZONE_MAX_COUNT 3
+#define APP_ZONE_NAME_LEN 8
+#define APP_ZONE_CURVE_LEN 100
+
+enum app_zone_mode
+{
+    APP_ZONE_MODE_CURVE,
+    APP_ZONE_MODE_PID,
+    APP_ZONE_MODE_RPM, // Curve gives fraction of max RPM, needs calibration
+};
+
+/**
+ * Hardware of single zone, pins < 0 are not connected.
+ */
+struct app_zone_hw
+{
+    int pwm_pin;
+    ledc_channel_t pwm_channel;
+    int rpm_pin;
+    pcnt_unit_t rpm_unit;
+};
+
+/**
+ * Fan group driven by one or more source sensors, with its own curve or PID controller.
+ */
+struct app_zone
+{
+    size_t index;
+    char name[APP_ZONE_NAME_LEN]; // Used as sensor label, "Fan", "Fan 2", ...
+    struct app_zone_hw hw;
+
+    // Config
+    bool force_max_duty;
+    float low_duty_percent;
+    float high_duty_percent;
+    float low_temperature_threshold;
+    float high_temperature_threshold;
+    size_t sensor_index; // Primary sensor, sole source unless sources are set
+    enum app_fusion_policy fusion;
+    portMUX_TYPE lock; // Guards sources and requests, they are changed from other tasks than the control one
+    struct app_fusion_source sources[APP_FUSION_MAX_SOURCES];
+    size_t source_count;
+    char curve_points[APP_ZONE_CURVE_LEN]; // Empty means linear low-high curve
+    float curve_hysteresis_c;
+    float curve_slew_rate;
+    enum app_zone_mode mode; // Requested, control task switches to it on next update
+    bool calibrate;          // Requested, control task starts the sweep on next update
+    float pid_setpoint_c;
+    float pid_kp;
+    float pid_ki;
+    float pid_kd;
+    float pid_kff;
+
+    // State, owned by the control task
+    enum app_zone_mode active_mode;
+    struct app_tach tach; // Used when HW_RPM_PERIOD is enabled
+    pc_fan_rpm_sampling_ptr rpm;
+    esp_timer_handle_t rpm_timer;
+    float duty_percent;
+    bool duty_written;
+    struct app_curve curve;
+    struct app_pid pid;
+    struct app_calibration calibration;
+    struct app_calibration_sweep sweep;
+    uint16_t rpm_target; // Only in RPM mode
+    float rpm_trim;
+    struct app_health health;
+    struct app_curve source_curves[APP_FUSION_MAX_SOURCES]; // Only with APP_FUSION_CURVE_MAX
+    bool source_curve_own[APP_FUSION_MAX_SOURCES];          // Otherwise copy of zone curve
+    float input_c;                                          // Combined temperature of sources
+    bool input_valid;
+    bool failsafe; // Forces full speed, overrides everything but calibration
+};
+
+/**
+ * Sets default config, initializes fan control and RPM sampling, and sets fan to high duty.
+ */
+esp_err_t app_zone_init(struct app_zone *zone, size_t index, const struct app_zone_hw *hw);
+
+/**
+ * Rebuilds curve from curve_points, or from low-high thresholds when empty.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on malformed curve_points.
+ */
+esp_err_t app_zone_update_curve(struct app_zone *zone);
+
+/**
+ * Sets source sensors of the zone.
+ *
+ * @param zone Zone
+ * @param sources Sources, sensor indexes must be valid
+ * @param count Number of sources, 1 to APP_FUSION_MAX_SOURCES
+ * @param curves Optional curve of each source in app_curve_parse() format, NULL or empty to use zone curve
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG on invalid sources or curves.
+ */
+esp_err_t app_zone_set_sources(struct app_zone *zone, const struct app_fusion_source *sources, size_t count, const char *const *curves);
+
+/**
+ * Copies current sources of the zone, safe from any task.
+ *
+ * @param zone Zone
+ * @param sources Output, at least APP_FUSION_MAX_SOURCES long
+ * @return Number of sources.
+ */
+size_t app_zone_get_sources(struct app_zone *zone, struct app_fusion_source *sources);
+
+void app_zone_set_hysteresis(struct app_zone *zone, float hysteresis_c);
+
+void app_zone_set_slew_rate(struct app_zone *zone, float slew_rate);
+
+/**
+ * Distance of the sensor temperature to nearest point of zone curves it drives, INFINITY if it is not a source.
+ */
+float app_zone_curve_distance(struct app_zone *zone, size_t sensor_index, float temperature_c);
+
+/**
+ * Requests control mode change, applied by next app_zone_control(). Switch to PID is bumpless, starting from current duty.
+ */
+void app_zone_set_mode(struct app_zone *zone, enum app_zone_mode mode);
+
+/**
+ * Requests calibration sweep, started by next app_zone_control() or app_zone_fallback(). It overrides control
+ * until it is finished. Result is then used right away, but it has to be stored by app_zone_calibration_store().
+ *
+ * @return true if the sweep was requested, false when zone has no tachometer.
+ */
+bool app_zone_calibrate(struct app_zone *zone);
+
+/**
+ * Stores calibration result to NVS. Blocks on flash, so it must not be called from the control task.
+ */
+esp_err_t app_zone_calibration_store(const struct app_zone *zone, const struct app_calibration *calibration);
+
+/**
+ * Writes duty to the fan, only when it changes.
+ */
+void app_zone_set_duty(struct app_zone *zone, float duty_percent);
+
+/**
+ * Computes and writes next duty from temperatures of source sensors. Invalid sensors are skipped,
+ * when none of them is valid, zone falls back to high duty.
+ *
+ * @param zone Zone
+ * @param values_c Filtered temperatures of all sensors
+ * @param valid Validity of all sensors
+ * @param dt_s Time since last update
+ */
+void app_zone_control(struct app_zone *zone, const float *values_c, const bool *valid, float dt_s);
+
+/**
+ * Sets high duty, used until first temperature is available.
+ */
+void app_zone_fallback(struct app_zone *zone);
+
+/**
+ * Current RPM, 0 when there is no tachometer.
+ */
+uint16_t app_zone_rpm(struct app_zone *zone);
+
+/**
+ * Pulse counter, for rate computation.
+ */
+uint32_t app_zone_rpm_count(struct app_zone *zone);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,94 @@
+#include "util_chunked.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static esp_err_t util_chunked_flush(struct util_chunked *out)
+{
+    if (out->len > 0 && out->err == ESP_OK)
+    {
+        out->err = httpd_resp_send_chunk(out->req, out->buf, (ssize_t)out->len);
+    }
+    out->len = 0;
+    return out->err;
+}
+
+void util_chunked_init(struct util_chunked *out, httpd_req_t *req)
+{
+    assert(out);
+    assert(req);
+
+    out->req = req;
+    out->err = ESP_OK;
+    out->len = 0;
+}
+
+esp_err_t util_chunked_append(struct util_chunked *out, const char *fmt, ...)
+{
+    assert(out);
+    assert(fmt);
+
+    if (out->err != ESP_OK) return out->err;
+
+    va_list args;
+    va_start(args, fmt);
+
+    // Try to fit into what is left in the buffer
+    va_list args_copy;
+    va_copy(args_copy, args);
+    size_t n = sizeof(out->buf) - out->len;
+    int count = vsnprintf(out->buf + out->len, n, fmt, args_copy);
+    va_end(args_copy);
+
+    if (count >= 0 && (size_t)count >= n)
+    {
+        // Does not fit, send what we have and start over with empty buffer
+        if (util_chunked_flush(out) == ESP_OK)
+        {
+            if ((size_t)count < sizeof(out->buf))
+            {
+                vsnprintf(out->buf, sizeof(out->buf), fmt, args);
+            }
+            else
+            {
+                // Longer than whole buffer, format it on heap and send it right away
+                char *tmp = malloc((size_t)count + 1);
+                if (tmp)
+                {
+                    vsnprintf(tmp, (size_t)count + 1, fmt, args);
+                    out->err = httpd_resp_send_chunk(out->req, tmp, count);
+                    free(tmp);
+                }
+                else
+                {
+                    out->err = ESP_ERR_NO_MEM;
+                }
+                count = 0;
+            }
+        }
+    }
+    va_end(args);
+
+    if (count < 0)
+    {
+        out->err = ESP_FAIL;
+    }
+    else if (out->err == ESP_OK)
+    {
+        out->len += (size_t)count;
+    }
+    return out->err;
+}
+
+esp_err_t util_chunked_finish(struct util_chunked *out)
+{
+    assert(out);
+
+    if (util_chunked_flush(out) == ESP_OK)
+    {
+        // Empty chunk terminates the response
+        out->err = httpd_resp_send_chunk(out->req, NULL, 0);
+    }
+    return out->err;
+}
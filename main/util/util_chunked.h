@@ -0,0 +1,40 @@
+#pragma once
+
+#include <esp_http_server.h>
+
+#ifndef UTIL_CHUNKED_BUFFER_SIZE
+#define UTIL_CHUNKED_BUFFER_SIZE 256
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Streaming response writer, formatted output is collected in small buffer and sent as a HTTP chunk
+ * whenever it fills up. Total response size is not limited.
+ */
+struct util_chunked
+{
+    httpd_req_t *req;
+    esp_err_t err;
+    size_t len;
+    char buf[UTIL_CHUNKED_BUFFER_SIZE];
+};
+
+void util_chunked_init(struct util_chunked *out, httpd_req_t *req);
+
+/**
+ * Appends formatted string to the response. Errors are sticky, once sending fails, all following calls are no-op,
+ * so it is enough to check result of util_chunked_finish().
+ */
+__attribute__((format(printf, 2, 3))) esp_err_t util_chunked_append(struct util_chunked *out, const char *fmt, ...);
+
+/**
+ * Sends remaining buffer and terminates the response.
+ */
+esp_err_t util_chunked_finish(struct util_chunked *out);
+
+#ifdef __cplusplus
+}
+#endif
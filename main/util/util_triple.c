@@ -0,0 +1,45 @@
+#include "util_triple.h"
+#include <assert.h>
+
+#define UTIL_TRIPLE_FRESH 4u
+#define UTIL_TRIPLE_INDEX 3u
+
+void util_triple_init(struct util_triple *t, void *front, void *middle, void *back)
+{
+    assert(t);
+    assert(front && middle && back);
+
+    t->buffers[0] = front;
+    t->buffers[1] = middle;
+    t->buffers[2] = back;
+    t->front = 0;
+    atomic_init(&t->middle, 1);
+    t->back = 2;
+}
+
+void *util_triple_back(struct util_triple *t)
+{
+    return t->buffers[t->back];
+}
+
+void util_triple_publish(struct util_triple *t)
+{
+    // Swap with the shared one, reader picks it up on its next call
+    unsigned int previous = atomic_exchange(&t->middle, t->back | UTIL_TRIPLE_FRESH);
+    t->back = previous & UTIL_TRIPLE_INDEX;
+}
+
+const void *util_triple_front(struct util_triple *t, bool *fresh)
+{
+    bool published = (atomic_load(&t->middle) & UTIL_TRIPLE_FRESH) != 0;
+    if (published)
+    {
+        unsigned int previous = atomic_exchange(&t->middle, t->front);
+        t->front = previous & UTIL_TRIPLE_INDEX;
+    }
+    if (fresh)
+    {
+        *fresh = published;
+    }
+    return t->buffers[t->front];
+}
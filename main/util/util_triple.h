@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Latest-value channel between one writer and one reader task (triple buffer). Writer always has a buffer to fill,
+ * reader always gets the newest complete one, and neither of them ever waits, so it is safe between tasks
+ * of any priority, on any core. Values that are not read before the next publish are skipped.
+ */
+struct util_triple
+{
+    void *buffers[3];
+    atomic_uint middle; // Index of shared buffer, with UTIL_TRIPLE_FRESH when it was published but not read yet
+    unsigned int back;  // Owned by writer
+    unsigned int front; // Owned by reader
+};
+
+/**
+ * Buffers must be the same size, reader gets the first one until something is published.
+ */
+void util_triple_init(struct util_triple *t, void *front, void *middle, void *back);
+
+/**
+ * Buffer to fill, it holds stale data, so whole value must be written.
+ */
+void *util_triple_back(struct util_triple *t);
+
+/**
+ * Makes filled buffer the newest value.
+ */
+void util_triple_publish(struct util_triple *t);
+
+/**
+ * Returns the newest published value, valid until next call.
+ *
+ * @param t Channel
+ * @param fresh Optional, set to true when value was published since last call
+ */
+const void *util_triple_front(struct util_triple *t, bool *fresh);
+
+#ifdef __cplusplus
+}
+#endif